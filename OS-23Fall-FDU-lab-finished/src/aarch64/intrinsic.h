@@ -27,6 +27,21 @@ static WARN_RESULT ALWAYS_INLINE u64 get_timestamp() {
     return result;
 }
 
+// enable the PMU cycle counter (PMCCNTR_EL0) on this CPU.
+static ALWAYS_INLINE void arch_enable_cycle_counter() {
+    asm volatile("msr pmcr_el0, %[x]" : : [x] "r"(1ll));  // E
+    asm volatile("msr pmcntenset_el0, %[x]" : : [x] "r"(1ll << 31));
+    asm volatile("isb");
+}
+
+static WARN_RESULT ALWAYS_INLINE u64 get_cycles() {
+    u64 result;
+    compiler_fence();
+    asm volatile("mrs %[x], pmccntr_el0" : [x] "=r"(result));
+    compiler_fence();
+    return result;
+}
+
 // instruction synchronization barrier.
 static ALWAYS_INLINE void arch_isb() {
     asm volatile("isb" ::: "memory");
@@ -231,6 +246,10 @@ static inline void delay(i32 count) {
 }
 void delay_us(u64 n);
 
+// see page.S. Both pages must be PAGE_SIZE aligned.
+void copy_page(void* dst, const void* src);
+void clear_page(void* page);
+
 #define set_return_addr(addr) \
     (compiler_fence(), ((volatile u64*)__builtin_frame_address(0))[1] = (u64)(addr), \
      compiler_fence())
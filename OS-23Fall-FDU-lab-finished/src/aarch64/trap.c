@@ -1,5 +1,6 @@
 #include <aarch64/trap.h>
 #include <aarch64/intrinsic.h>
+#include <common/rcu.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
 #include <driver/interrupt.h>
@@ -10,6 +11,10 @@
 void trap_global_handler(UserContext* context)
 {
     thisproc()->ucontext = context;
+    // user code holds no kernel references, and kernel code that runs
+    // with interrupts on may be switched out here, see check_resched()
+    if ((context->spsr & SPSR_EL_MASK) == 0 || !(context->spsr & SPSR_I))
+        rcu_quiescent_state();
     u64 esr = arch_get_esr();
     u64 ec = esr >> ESR_EC_SHIFT;
     u64 iss = esr & ESR_ISS_MASK;
@@ -52,6 +57,10 @@ void trap_global_handler(UserContext* context)
     // TODO: stop killed process while returning to user space
     if(thisproc()->killed == 1) exit(-1);
 
+    // a real-time process woke up while we ran. only preempt a context
+    // that ran with interrupts on, the kernel holds locks with them off.
+    if(!(context->spsr & SPSR_I)) check_resched();
+
 }
 
 NO_RETURN void trap_error_handler(u64 type)
@@ -12,3 +12,6 @@
 #define ESR_EC_IABORT_EL1  0x21
 #define ESR_EC_DABORT_EL0  0x24
 #define ESR_EC_DABORT_EL1  0x25
+
+#define SPSR_I (1 << 7)
+#define SPSR_EL_MASK (3 << 2)   // 0: the trap came from EL0
@@ -6,7 +6,8 @@
 #include "kernel/printk.h"
 static ipc_ids msg_ids;
 void init_ipc() {
-    init_spinlock(&msg_ids.lock);
+    init_rwlock(&msg_ids.lock);
+    lockstat_register_rwlock(&msg_ids.lock, "msg_ids");
     msg_ids.in_use = 0;
     msg_ids.seq = 0;
     msg_ids.size = 16;
@@ -43,9 +44,13 @@ static int newque(int key) {
     que->key = key;
     que->max_msg = MAX_MSGNUM;
     que->sum_msg = 0;
+    init_spinlock(&que->lock);
+    lockstat_register(&que->lock, "msg_queue");
+    init_rc(&que->ref);
+    _increment_rc(&que->ref);
     init_list_node(&que->q_message);
     init_list_node(&que->q_receiver);
-    init_list_node(&que->q_sender);
+    init_waitqueue(&que->q_sender);
     return ipc_buildin(id, que->seq);
 }
 static int ipc_findkey(int key) {
@@ -58,7 +63,23 @@ static int ipc_findkey(int key) {
 }
 int sys_msgget(int key, int msgflg) {
     int ret;
-    _acquire_spinlock(&msg_ids.lock);
+    // most calls find an existing queue, which only needs a reader
+    if (key != IPC_PRIVATE) {
+        _acquire_read_lock(&msg_ids.lock);
+        int id = ipc_findkey(key);
+        if (id != -1 || !(msgflg & IPC_CREATE)) {
+            if (id == -1)
+                ret = ENOENT;
+            else if (msgflg & IPC_EXCL)
+                ret = EEXIST;
+            else
+                ret = ipc_buildin(id, msg_ids.entries[id]->seq);
+            _release_read_lock(&msg_ids.lock);
+            return ret;
+        }
+        _release_read_lock(&msg_ids.lock);
+    }
+    _acquire_write_lock(&msg_ids.lock);
     if (key == IPC_PRIVATE)
         ret = newque(key);
     else {
@@ -75,7 +96,7 @@ int sys_msgget(int key, int msgflg) {
                 ret = ipc_buildin(id, msg_ids.entries[id]->seq);
         }
     }
-    _release_spinlock(&msg_ids.lock);
+    _release_write_lock(&msg_ids.lock);
     return ret;
 }
 static void free_msg(msg_msg* msg) {
@@ -88,7 +109,7 @@ static void free_msg(msg_msg* msg) {
     kfree_page(msg);
 }
 static msg_msg* load_msg(void* src, int len) {
-    msg_msg* msg = (msg_msg*)kalloc_page();
+    msg_msg* msg = (msg_msg*)kalloc_page_nozero();
     if (msg == NULL)
         return NULL;
     memcpy(msg->data, src, MIN(MSG_MSGSZ, len));
@@ -97,7 +118,7 @@ static msg_msg* load_msg(void* src, int len) {
     msg->nxt = NULL;
     msg_msgseg** lst = &msg->nxt;
     while (len > 0) {
-        msg_msgseg* mseg = (msg_msgseg*)kalloc_page();
+        msg_msgseg* mseg = (msg_msgseg*)kalloc_page_nozero();
         if (mseg == NULL)
             goto free_obj;
         memcpy(mseg->data, src, MIN(MSG_MSGSEGSZ, len));
@@ -120,6 +141,21 @@ static msg_queue* get_msgq(int msgid) {
         return NULL;
     return msg_ids.entries[id];
 }
+// find a queue and lock it. The table stays locked until we hold the
+// queue, and freeque() takes the queue lock after it has removed the
+// queue from the table, so the queue cannot go away under us.
+static msg_queue* lock_msgq(int msgid) {
+    _acquire_read_lock(&msg_ids.lock);
+    msg_queue* msgq = get_msgq(msgid);
+    if (msgq != NULL)
+        _acquire_spinlock(&msgq->lock);
+    _release_read_lock(&msg_ids.lock);
+    return msgq;
+}
+static void put_msgq(msg_queue* msgq) {
+    if (_decrement_rc(&msgq->ref))
+        kfree((void*)msgq);
+}
 static int testmsg(int rqtype, int type) {
     if (rqtype == 0)
         return 1;
@@ -156,9 +192,9 @@ int sys_msgsnd(int msgid, msgbuf* msgp, int msgsz, int msgflg) {
         return ENOMEM;
     msg->mtype = msgp->mtype;
     msg->size = msgsz;
+    msg_queue* msgq;
 retry:
-    _acquire_spinlock(&msg_ids.lock);
-    msg_queue* msgq = get_msgq(msgid);
+    msgq = lock_msgq(msgid);
     if (msgq == NULL) {
         err = EIDRM;
         goto free_obj;
@@ -166,34 +202,28 @@ retry:
     if (msgq->sum_msg + 1 > msgq->max_msg) {
         if (msgflg & IPC_NOWAIT) {
             err = EAGAIN;
-            goto free_obj;
+            goto out_lock;
         }
-        msg_sender sender;
-        sender.proc = thisproc();
-        _insert_into_list(msgq->q_sender.prev, &sender.node);
-        _acquire_sched_lock();
-        _release_spinlock(&msg_ids.lock);
-        _sched(SLEEPING);
+        // the queue may be removed while we sleep: keep it allocated, and
+        // look it up again when we wake up
+        _increment_rc(&msgq->ref);
+        wait_queue_exclusive(&msgq->q_sender, &msgq->lock);
+        _release_spinlock(&msgq->lock);
+        put_msgq(msgq);
         goto retry;
     }
     if (!pipeline_send(msgq, msg)) {
         _insert_into_list(msgq->q_message.prev, &msg->node);
         msgq->sum_msg++;
     }
-    _release_spinlock(&msg_ids.lock);
+    _release_spinlock(&msgq->lock);
     return 0;
+out_lock:
+    _release_spinlock(&msgq->lock);
 free_obj:
-    _release_spinlock(&msg_ids.lock);
     free_msg(msg);
     return err;
 }
-static void ss_wakeup(ListNode* head) {
-    while (!_empty_list(head)) {
-        ListNode* node = head->next;
-        _detach_from_list(node);
-        activate_proc(container_of(node, msg_sender, node)->proc);
-    }
-}
 static void store_msg(msgbuf* dstg, msg_msg* msg, int msgsz) {
     void* dst = dstg->data;
     dstg->mtype = msg->mtype;
@@ -212,12 +242,9 @@ int sys_msgrcv(int msgid, msgbuf* msgp, int msgsz, int mtype, int msgflg) {
     int err = EINVAL;
     if (msgsz < 0 || msgp == NULL)
         return EINVAL;
-    _acquire_spinlock(&msg_ids.lock);
-    msg_queue* msgq = get_msgq(msgid);
-    if (msgq == NULL) {
-        err = EIDRM;
-        goto out_lock;
-    }
+    msg_queue* msgq = lock_msgq(msgid);
+    if (msgq == NULL)
+        return EIDRM;
     msg_msg* found_msg = NULL;
     _for_in_list(node, &msgq->q_message) {
         if (node == &msgq->q_message)
@@ -238,8 +265,9 @@ int sys_msgrcv(int msgid, msgbuf* msgp, int msgsz, int mtype, int msgflg) {
         }
         _detach_from_list(&found_msg->node);
         msgq->sum_msg--;
-        ss_wakeup(&msgq->q_sender);
-        _release_spinlock(&msg_ids.lock);
+        // room for one more message
+        wake_up_one(&msgq->q_sender);
+        _release_spinlock(&msgq->lock);
     } else {
         if (msgflg & IPC_NOWAIT) {
             err = ENOMSG;
@@ -251,7 +279,7 @@ int sys_msgrcv(int msgid, msgbuf* msgp, int msgsz, int mtype, int msgflg) {
         receiver.proc = thisproc();
         receiver.size = msgsz;
         _acquire_sched_lock();
-        _release_spinlock(&msg_ids.lock);
+        _release_spinlock(&msgq->lock);
         _sched(SLEEPING);
         found_msg = receiver.r_msg;
         if (found_msg == NULL)
@@ -262,7 +290,7 @@ int sys_msgrcv(int msgid, msgbuf* msgp, int msgsz, int mtype, int msgflg) {
     free_msg(found_msg);
     return msgsz;
 out_lock:
-    _release_spinlock(&msg_ids.lock);
+    _release_spinlock(&msgq->lock);
     return err;
 }
 static void expunge_all(msg_queue* que) {
@@ -274,21 +302,25 @@ static void expunge_all(msg_queue* que) {
     }
 }
 static void freeque(int id) {
-    _acquire_spinlock(&msg_ids.lock);
+    _acquire_write_lock(&msg_ids.lock);
     msg_queue* msgq = get_msgq(id);
     if (msgq != NULL) {
         msg_ids.entries[id % SEQ_MULTIPLIER] = NULL;
-        ss_wakeup(&msgq->q_receiver);
-        expunge_all(msgq);
-        while (!_empty_list(&msgq->q_message)) {
-            ListNode* node = msgq->q_message.next;
-            _detach_from_list(node);
-            free_msg(container_of(node, msg_msg, node));
-        }
         msg_ids.in_use--;
-        kfree((void*)msgq);
     }
-    _release_spinlock(&msg_ids.lock);
+    _release_write_lock(&msg_ids.lock);
+    if (msgq == NULL)
+        return;
+    _acquire_spinlock(&msgq->lock);
+    expunge_all(msgq);
+    wake_up_all(&msgq->q_sender);
+    while (!_empty_list(&msgq->q_message)) {
+        ListNode* node = msgq->q_message.next;
+        _detach_from_list(node);
+        free_msg(container_of(node, msg_msg, node));
+    }
+    _release_spinlock(&msgq->lock);
+    put_msgq(msgq);
 }
 int sys_msgctl(int msgid, int cmd) {
     if (cmd == IPC_RMID) {
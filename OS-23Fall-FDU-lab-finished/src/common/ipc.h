@@ -1,5 +1,7 @@
 #ifndef __IPC_H
 #define __IPC_H
+#include "rc.h"
+#include "rwlock.h"
 #include "sem.h"
 #define ENOMEM -1
 #define ENOSEQ -2
@@ -24,15 +26,17 @@ typedef struct msg_queue {
     int seq;
     int max_msg;
     int sum_msg;
+    SpinLock lock;          // sum_msg and the lists
+    RefCount ref;           // the table, and senders asleep on q_sender
     ListNode q_message;
-    ListNode q_sender;
+    WaitQueue q_sender;     // senders waiting for room, exclusive
     ListNode q_receiver;
 } msg_queue;
 typedef struct ipc_ids {
     int size;
     int in_use;
     unsigned short seq;
-    SpinLock lock;
+    RWLock lock;            // the table only, each queue has its own lock
     msg_queue* entries[16];
 } ipc_ids;
 typedef struct msgbuf {
@@ -50,10 +54,6 @@ typedef struct msg_msg {
     msg_msgseg* nxt;
     char data[];
 } msg_msg;
-typedef struct msg_sender {
-    ListNode node;
-    struct proc* proc;
-} msg_sender;
 typedef struct msg_receiver {
     ListNode node;
     struct proc* proc;
@@ -0,0 +1,90 @@
+#include <common/lockstat.h>
+
+#ifdef LOCKSTAT
+
+#include <common/string.h>
+#include <kernel/printk.h>
+
+#define LOCKSTAT_MAX 64
+
+static SpinLock stats_lock;     // never registered itself
+static struct lock_stat stats[LOCKSTAT_MAX];
+static int nr_stats;
+
+void lockstat_register(SpinLock* lock, const char* name)
+{
+    _acquire_spinlock(&stats_lock);
+    int i = 0;
+    while (i < nr_stats && strncmp(stats[i].name, name, 32) != 0)
+        i++;
+    if (i == nr_stats) {
+        if (nr_stats == LOCKSTAT_MAX) {
+            _release_spinlock(&stats_lock);
+            return;
+        }
+        stats[nr_stats++].name = name;
+    }
+    lock->stat = &stats[i];
+    _release_spinlock(&stats_lock);
+}
+
+// locks sharing a name may be taken on several CPUs at once.
+void lockstat_acquired(struct lock_stat* s, bool contended, u64 spin)
+{
+    __atomic_fetch_add(&s->acquired, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&s->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->spin, spin, __ATOMIC_RELAXED);
+    }
+}
+
+void lockstat_released(struct lock_stat* s, u64 hold)
+{
+    u64 max = __atomic_load_n(&s->max_hold, __ATOMIC_RELAXED);
+    while (hold > max &&
+           !__atomic_compare_exchange_n(&s->max_hold, &max, hold, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void lockstat_slept(SpinLock* lock, u64 time)
+{
+    if (lock->stat == NULL)
+        return;
+    __atomic_fetch_add(&lock->stat->sleeps, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lock->stat->sleep, time, __ATOMIC_RELAXED);
+}
+
+static u64 wait_time(struct lock_stat* s)
+{
+    return s->spin + s->sleep;
+}
+
+static u64 to_us(u64 ticks)
+{
+    return ticks * 1000000 / get_clock_frequency();
+}
+
+int lockstat_dump(int n)
+{
+    static struct lock_stat* order[LOCKSTAT_MAX];
+    _acquire_spinlock(&stats_lock);
+    int cnt = nr_stats;
+    for (int i = 0; i < cnt; i++) {
+        int j = i;
+        for (; j > 0 && wait_time(order[j - 1]) < wait_time(&stats[i]); j--)
+            order[j] = order[j - 1];
+        order[j] = &stats[i];
+    }
+    printk("lockstat: name acquired contended spin(us) max_hold(us) sleeps sleep(us)\n");
+    for (int i = 0; i < cnt && i < n; i++) {
+        struct lock_stat* s = order[i];
+        printk("  %s %llu %llu %llu %llu %llu %llu\n", s->name, s->acquired,
+               s->contended, to_us(s->spin), to_us(s->max_hold), s->sleeps,
+               to_us(s->sleep));
+    }
+    _release_spinlock(&stats_lock);
+    return cnt;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/spinlock.h>
+
+// Lock contention statistics, enabled with `cmake -DLOCKSTAT=ON`.
+//
+// Only locks given a name with lockstat_register (or
+// lockstat_register_sleeplock) are counted. Times are in timer ticks,
+// see get_timestamp().
+
+struct lock_stat {
+    const char* name;
+    u64 acquired;   // acquisitions
+    u64 contended;  // acquisitions that had to wait
+    u64 spin;       // total time spent spinning
+    u64 max_hold;   // longest time the lock was held
+    u64 sleeps;     // sleep locks: waits that went to sleep
+    u64 sleep;      // sleep locks: total time asleep
+};
+
+#ifdef LOCKSTAT
+
+void lockstat_acquired(struct lock_stat*, bool contended, u64 spin);
+void lockstat_released(struct lock_stat*, u64 hold);
+// a sleep lock whose inner spinlock is `lock` slept for `time`.
+void lockstat_slept(SpinLock* lock, u64 time);
+
+// print the `n` locks that were waited for longest. Returns the number of
+// registered names.
+int lockstat_dump(int n);
+
+#endif
@@ -294,4 +294,16 @@ rb_node _rb_first(rb_root root) {
     while (n->rb_left)
         n = n->rb_left;
     return n;
+}
+rb_node _rb_next(rb_node node) {
+    rb_node parent;
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->rb_right)
+        node = parent;
+    return parent;
 }
\ No newline at end of file
@@ -12,3 +12,13 @@ bool _decrement_rc(RefCount *rc) {
     i64 r = __atomic_sub_fetch(&rc->count, 1, __ATOMIC_ACQ_REL);
     return r <= 0;
 }
+
+bool _try_increment_rc(RefCount *rc) {
+    isize r = __atomic_load_n(&rc->count, __ATOMIC_RELAXED);
+    while (r > 0) {
+        if (__atomic_compare_exchange_n(&rc->count, &r, r + 1, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
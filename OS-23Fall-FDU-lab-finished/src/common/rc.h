@@ -9,6 +9,9 @@ typedef struct {
 
 void _increment_rc(RefCount*);
 bool _decrement_rc(RefCount*);
+// atomic increment unless the count is zero or below, for a lookup that
+// races with the last put. Returns true if it took a reference.
+WARN_RESULT bool _try_increment_rc(RefCount*);
 
 // initialize reference count to zero.
 void init_rc(RefCount*);
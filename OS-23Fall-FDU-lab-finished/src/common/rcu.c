@@ -0,0 +1,155 @@
+#include <common/lockstat.h>
+#include <common/rcu.h>
+#include <driver/interrupt.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+
+// One grace period at a time. Callbacks queued while it runs wait for the
+// next one, which starts as soon as it ends.
+static struct {
+    SpinLock lock;
+    volatile u32 pending;   // cpus that have not passed a quiescent state yet
+    volatile u32 idle;      // cpus in the idle loop, not waited for
+    bool active;            // a grace period is running
+    ListNode next;          // queued, not waiting yet
+    ListNode cur;           // waiting for the running grace period
+    ListNode done;          // ready to run
+} rcu;
+
+// read-side nesting, to catch a reader that sleeps.
+static int nesting[NCPU];
+
+define_early_init(rcu)
+{
+    init_spinlock(&rcu.lock);
+    lockstat_register(&rcu.lock, "rcu");
+    rcu.pending = rcu.idle = 0;
+    rcu.active = false;
+    init_list_node(&rcu.next);
+    init_list_node(&rcu.cur);
+    init_list_node(&rcu.done);
+}
+
+void rcu_read_lock()
+{
+    nesting[cpuid()]++;
+    compiler_fence();
+}
+
+void rcu_read_unlock()
+{
+    compiler_fence();
+    nesting[cpuid()]--;
+}
+
+// move every node of `from` to the end of `to`.
+static void splice_list(ListNode* from, ListNode* to)
+{
+    if (_empty_list(from))
+        return;
+    ListNode* first = from->next;
+    _detach_from_list(from);
+    _merge_list(to->prev, first);
+}
+
+static void finish_gp();
+
+// rcu.lock is held. The callers unlinked their objects before this, and
+// the fence orders that before we read which cpus are idle: a cpu that
+// leaves idle after this cannot find them any more.
+static void start_gp()
+{
+    rcu.active = true;
+    splice_list(&rcu.next, &rcu.cur);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    rcu.pending = CPU_MASK_ALL & ~rcu.idle;
+    if (rcu.pending == 0) {
+        finish_gp();
+        return;
+    }
+    // the interrupt traps as soon as each cpu runs with interrupts on,
+    // which is a quiescent state unless it switches or idles first.
+    for (int i = 0; i < NCPU; i++)
+        if (rcu.pending & (1u << i))
+            send_ipi(i);
+}
+
+static void finish_gp()
+{
+    rcu.active = false;
+    splice_list(&rcu.cur, &rcu.done);
+    if (!_empty_list(&rcu.next))
+        start_gp();
+}
+
+// rcu.lock is held.
+static void report_qs(u32 bit)
+{
+    if (!(rcu.pending & bit))
+        return;
+    rcu.pending &= ~bit;
+    if (rcu.pending == 0)
+        finish_gp();
+}
+
+void rcu_quiescent_state()
+{
+    int i = cpuid();
+    ASSERT(nesting[i] == 0);
+    if (!(__atomic_load_n(&rcu.pending, __ATOMIC_RELAXED) & (1u << i)))
+        return;
+    _acquire_spinlock(&rcu.lock);
+    report_qs(1u << i);
+    _release_spinlock(&rcu.lock);
+}
+
+// under the lock, so that a grace period that starts meanwhile either
+// waits for us and is told here, or sees us idle. Only this cpu changes
+// its bit, so it can be checked without the lock.
+void rcu_idle_enter()
+{
+    u32 bit = 1u << cpuid();
+    ASSERT(nesting[cpuid()] == 0);
+    if (rcu.idle & bit)
+        return;
+    _acquire_spinlock(&rcu.lock);
+    rcu.idle |= bit;
+    report_qs(bit);
+    _release_spinlock(&rcu.lock);
+}
+
+// pairs with the fence in start_gp(): either the grace period waits for
+// us, or our lookups after this see the objects unlinked.
+void rcu_idle_exit()
+{
+    u32 bit = 1u << cpuid();
+    if (!(rcu.idle & bit))
+        return;
+    __atomic_fetch_and(&rcu.idle, ~bit, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_run_callbacks()
+{
+    ListNode list;
+    init_list_node(&list);
+    _acquire_spinlock(&rcu.lock);
+    splice_list(&rcu.done, &list);
+    _release_spinlock(&rcu.lock);
+    while (!_empty_list(&list)) {
+        struct rcu_head* head = container_of(list.next, struct rcu_head, node);
+        _detach_from_list(&head->node);
+        head->func(head);
+    }
+}
+
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head*))
+{
+    rcu_run_callbacks();
+    head->func = func;
+    _acquire_spinlock(&rcu.lock);
+    _insert_into_list(rcu.next.prev, &head->node);
+    if (!rcu.active)
+        start_gp();
+    _release_spinlock(&rcu.lock);
+}
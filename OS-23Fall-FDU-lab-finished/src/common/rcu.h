@@ -0,0 +1,66 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/list.h>
+
+// Quiescent-state-based RCU: lookups that take no lock, and deferred frees.
+//
+// Readers put their lookups between rcu_read_lock() and rcu_read_unlock().
+// They must not sleep, yield or turn interrupts on in between. A writer
+// unlinks an object under its usual lock and hands it to call_rcu(), which
+// runs the callback once every reader that may still see the object has
+// finished.
+//
+// Kernel code is never preempted, so a cpu holds no reference once it
+// passes a quiescent state: it is switching processes, it runs the idle
+// process, or it trapped from user space or from kernel code that ran
+// with interrupts on, which may be switched out there anyway. A grace
+// period ends when every cpu that was not idle has passed one. A cpu that
+// runs a lone process has no tick, so the cpus a grace period waits for
+// get an IPI when it starts.
+struct rcu_head {
+    ListNode node;
+    void (*func)(struct rcu_head*);
+};
+
+void rcu_read_lock();
+void rcu_read_unlock();
+// run func(head) after a grace period. It may run on any cpu with
+// interrupts off, possibly inside a later call_rcu(), so it should only
+// free memory.
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head*));
+
+// this cpu holds no reference, see above. Cheap unless a grace period
+// waits for this cpu.
+void rcu_quiescent_state();
+// the idle process holds no reference, so a cpu is not waited for while
+// it runs it. The scheduler calls these.
+void rcu_idle_enter();
+void rcu_idle_exit();
+// run the callbacks whose grace period has ended.
+void rcu_run_callbacks();
+
+// load a pointer that a writer may change under the reader.
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+// publish a pointer, after the object it points to has been set up.
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// Lists with lockless readers: writers still hold a lock, readers walk
+// forward only. A detached node keeps its next pointer, so a reader that
+// stands on it can go on; free it with call_rcu().
+static INLINE void rcu_insert_into_list(ListNode* list, ListNode* node) {
+    node->next = list->next;
+    node->prev = list;
+    list->next->prev = node;
+    rcu_assign_pointer(list->next, node);
+}
+
+static INLINE void rcu_detach_from_list(ListNode* node) {
+    node->next->prev = node->prev;
+    rcu_assign_pointer(node->prev->next, node->next);
+}
+
+// unlike _for_in_list, it does not visit the head.
+#define rcu_for_in_list(valptr, list)                                          \
+    for (ListNode* __flag = (list), *valptr = rcu_dereference(__flag->next);  \
+         valptr != __flag; valptr = rcu_dereference(valptr->next))
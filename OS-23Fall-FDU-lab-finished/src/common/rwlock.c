@@ -0,0 +1,35 @@
+#include <aarch64/intrinsic.h>
+#include <common/rwlock.h>
+
+void init_rwlock(RWLock* rw) {
+    rw->readers = 0;
+    init_spinlock(&rw->wlock);
+}
+
+void _acquire_read_lock(RWLock* rw) {
+    while (1) {
+        u32 v = __atomic_load_n(&rw->readers, __ATOMIC_RELAXED);
+        if (!(v & RW_WRITER) &&
+            __atomic_compare_exchange_n(&rw->readers, &v, v + 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        arch_yield();
+    }
+}
+
+void _release_read_lock(RWLock* rw) {
+    __atomic_fetch_sub(&rw->readers, 1, __ATOMIC_RELEASE);
+}
+
+// announce ourselves first, then wait for the readers inside to leave.
+void _acquire_write_lock(RWLock* rw) {
+    _acquire_spinlock(&rw->wlock);
+    __atomic_fetch_or(&rw->readers, RW_WRITER, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&rw->readers, __ATOMIC_ACQUIRE) != RW_WRITER)
+        arch_yield();
+}
+
+void _release_write_lock(RWLock* rw) {
+    __atomic_fetch_and(&rw->readers, ~RW_WRITER, __ATOMIC_RELEASE);
+    _release_spinlock(&rw->wlock);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common/spinlock.h>
+
+// A reader-writer spinlock: any number of readers, or one writer.
+//
+// A writer that is waiting keeps new readers out, so a stream of readers
+// cannot starve it. For the same reason a reader must not take a lock it
+// already holds for reading: a writer may have come in between.
+typedef struct {
+    volatile u32 readers;   // RW_WRITER is set while a writer holds or wants it
+    SpinLock wlock;         // taken by writers only
+} RWLock;
+
+#define RW_WRITER (1u << 31)
+
+void init_rwlock(RWLock*);
+void _acquire_read_lock(RWLock*);
+void _release_read_lock(RWLock*);
+void _acquire_write_lock(RWLock*);
+void _release_write_lock(RWLock*);
+
+// only the writers are counted, see lockstat.h.
+#define lockstat_register_rwlock(rw, name) lockstat_register(&(rw)->wlock, name)
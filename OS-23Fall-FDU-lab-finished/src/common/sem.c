@@ -1,7 +1,7 @@
 #include <common/sem.h>
-#include <kernel/mem.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
+#include <common/lockstat.h>
 
 void init_sem(Semaphore* sem, int val)
 {
@@ -69,23 +69,31 @@ bool _wait_sem(Semaphore* sem, bool alertable)
         release_spinlock(0, &sem->lock);
         return true;
     }
-    WaitData* wait = kalloc(sizeof(WaitData));
-    wait->proc = thisproc();
-    wait->up = false;
-    _insert_into_list(&sem->sleeplist, &wait->slnode);
+    // the waiter does not return before it takes sem->lock again, and the
+    // poster only touches the record under sem->lock, so it can live on
+    // our stack.
+    WaitData wait;
+    wait.proc = thisproc();
+    wait.up = false;
+    wait.exclusive = true;
+    _insert_into_list(&sem->sleeplist, &wait.slnode);
     lock_for_sched(0);
     release_spinlock(0, &sem->lock);
+#ifdef LOCKSTAT
+    u64 slept = get_timestamp();
     sched(0, alertable ? SLEEPING : DEEPSLEEPING);
+    lockstat_slept(&sem->lock, get_timestamp() - slept);
+#else
+    sched(0, alertable ? SLEEPING : DEEPSLEEPING);
+#endif
     acquire_spinlock(0, &sem->lock); // also the lock for waitdata
-    if (!wait->up) // wakeup by other sources
+    if (!wait.up) // wakeup by other sources
     {
         ASSERT(++sem->val <= 0);
-        _detach_from_list(&wait->slnode);
+        _detach_from_list(&wait.slnode);
     }
     release_spinlock(0, &sem->lock);
-    bool ret = wait->up;
-    kfree(wait);
-    return ret;
+    return wait.up;
 }
 
 void _post_sem(Semaphore* sem)
@@ -98,4 +106,46 @@ void _post_sem(Semaphore* sem)
         _detach_from_list(&wait->slnode);
         activate_proc(wait->proc);
     }
-}
\ No newline at end of file
+}
+void init_waitqueue(WaitQueue* wq)
+{
+    init_list_node(&wq->sleeplist);
+    wq->nr_wakeups = 0;
+}
+
+bool _wait_queue(WaitQueue* wq, SpinLock* lock, bool exclusive, bool alertable)
+{
+    WaitData wait;
+    wait.proc = thisproc();
+    wait.up = false;
+    wait.exclusive = exclusive;
+    // exclusive waiters queue at the tail, the others are woken first
+    if (exclusive)
+        _insert_into_list(wq->sleeplist.prev, &wait.slnode);
+    else
+        _insert_into_list(&wq->sleeplist, &wait.slnode);
+    _acquire_sched_lock();
+    _release_spinlock(lock);
+    _sched(alertable ? SLEEPING : DEEPSLEEPING);
+    _acquire_spinlock(lock);
+    if (!wait.up) // wakeup by other sources
+        _detach_from_list(&wait.slnode);
+    return wait.up;
+}
+
+int wake_up(WaitQueue* wq, int nr_exclusive)
+{
+    int woken = 0;
+    while (!_empty_list(&wq->sleeplist))
+    {
+        auto wait = container_of(wq->sleeplist.next, WaitData, slnode);
+        if (wait->exclusive && nr_exclusive-- == 0)
+            break;
+        wait->up = true;
+        _detach_from_list(&wait->slnode);
+        activate_proc(wait->proc);
+        woken++;
+    }
+    wq->nr_wakeups += woken;
+    return woken;
+}
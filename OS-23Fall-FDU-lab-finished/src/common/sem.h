@@ -6,6 +6,7 @@ struct proc;
 
 typedef struct {
     bool up;
+    bool exclusive;
     struct proc* proc;
     ListNode slnode;
 } WaitData;
@@ -34,8 +35,30 @@ void _post_sem(Semaphore*);
 #define post_sem(sem) (_lock_sem(sem), _post_sem(sem), _unlock_sem(sem))
 #define get_sem(sem) ({_lock_sem(sem); bool __ret = _get_sem(sem); _unlock_sem(sem); __ret;})
 
+// A queue of processes waiting for a condition that a spinlock of the
+// caller protects. The queue has no lock of its own: waiting and waking
+// both need the caller's lock held. Exclusive waiters are woken a few at a
+// time by wake_up(), the others all at once.
+typedef struct {
+    ListNode sleeplist;
+    u64 nr_wakeups;     // processes woken so far
+} WaitQueue;
+void init_waitqueue(WaitQueue*);
+// release `lock` while asleep, it is held again on return. returns false
+// if woken by something else than wake_up(), e.g. an alert.
+bool _wait_queue(WaitQueue*, SpinLock* lock, bool exclusive, bool alertable);
+// wake every non-exclusive waiter and up to nr_exclusive exclusive ones in
+// the order they came. returns the number woken.
+int wake_up(WaitQueue*, int nr_exclusive);
+#define wait_queue(wq, lock) _wait_queue(wq, lock, false, true)
+#define wait_queue_exclusive(wq, lock) _wait_queue(wq, lock, true, true)
+#define unalertable_wait_queue_exclusive(wq, lock) ASSERT(_wait_queue(wq, lock, true, false))
+#define wake_up_one(wq) wake_up(wq, 1)
+#define wake_up_all(wq) wake_up(wq, 0x7fffffff)
+
 #define SleepLock Semaphore
 #define init_sleeplock(lock) init_sem(lock, 1)
 #define acquire_sleeplock(checker, lock) (checker_begin_ctx(checker), wait_sem(lock))
 #define unalertable_acquire_sleeplock(checker, lock) (checker_begin_ctx(checker), unalertable_wait_sem(lock))
 #define release_sleeplock(checker, lock) (post_sem(lock), checker_end_ctx(checker))
+#define lockstat_register_sleeplock(sl, name) lockstat_register(&(sl)->lock, name)
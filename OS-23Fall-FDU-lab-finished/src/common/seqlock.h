@@ -0,0 +1,71 @@
+#pragma once
+
+#include <common/spinlock.h>
+
+// A sequence count for data that is read far more often than written.
+// It is even while the data is stable and odd while a writer changes it.
+// Readers write nothing to shared memory, they retry if the count moved
+// while they read:
+//
+//     do {
+//         seq = read_seqbegin(&s);
+//         ... copy the data ...
+//     } while (read_seqretry(&s, seq));
+//
+// A reader may see half-written data inside the loop, so it must not act
+// on it before read_seqretry() says it is good, nor follow a pointer that
+// a writer may free.
+typedef struct {
+    volatile u32 seq;
+} SeqCount;
+
+// a SeqCount with a lock of its own for the writers.
+typedef struct {
+    SeqCount count;
+    SpinLock lock;
+} SeqLock;
+
+static INLINE void init_seqcount(SeqCount* s) {
+    s->seq = 0;
+}
+
+static INLINE void init_seqlock(SeqLock* s) {
+    init_seqcount(&s->count);
+    init_spinlock(&s->lock);
+}
+
+static INLINE u32 read_seqcount_begin(SeqCount* s) {
+    u32 seq;
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        arch_yield();
+    return seq;
+}
+
+static INLINE bool read_seqcount_retry(SeqCount* s, u32 seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// the writers must be serialized by the caller, e.g. by the lock that
+// protects the data anyway.
+static INLINE void write_seqcount_begin(SeqCount* s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static INLINE void write_seqcount_end(SeqCount* s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+#define read_seqbegin(sl) read_seqcount_begin(&(sl)->count)
+#define read_seqretry(sl, seq) read_seqcount_retry(&(sl)->count, seq)
+
+static INLINE void write_seqlock(SeqLock* s) {
+    _acquire_spinlock(&s->lock);
+    write_seqcount_begin(&s->count);
+}
+
+static INLINE void write_sequnlock(SeqLock* s) {
+    write_seqcount_end(&s->count);
+    _release_spinlock(&s->lock);
+}
@@ -1,11 +1,54 @@
 #include <aarch64/intrinsic.h>
+#include <common/lockstat.h>
 #include <common/spinlock.h>
 
+#ifdef TICKET_SPINLOCK
+
+void init_spinlock(SpinLock* lock) {
+    lock->word = 0;
+#ifdef LOCKSTAT
+    lock->stat = NULL;
+#endif
+}
+
+static bool arch_try_acquire(SpinLock* lock) {
+    u64 old = lock->word;
+    // owner is the low half, next the high half.
+    if ((u32)old != (u32)(old >> 32))
+        return false;
+    return __atomic_compare_exchange_n(&lock->word, &old, old + (1ull << 32), false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// load-acquire exclusive, which also arms the exclusive monitor: the store
+// that moves `owner` on clears it and wakes us up from `wfe`.
+static ALWAYS_INLINE u32 load_owner(SpinLock* lock) {
+    u32 owner;
+    asm volatile("ldaxr %w[x], [%[p]]" : [x] "=r"(owner) : [p] "r"(&lock->owner) : "memory");
+    return owner;
+}
+
+static void arch_acquire(SpinLock* lock) {
+    u32 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (load_owner(lock) != ticket)
+        arch_wfe();
+}
+
+static void arch_release(SpinLock* lock) {
+    // only the holder writes `owner`.
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
 void init_spinlock(SpinLock* lock) {
     lock->locked = 0;
+#ifdef LOCKSTAT
+    lock->stat = NULL;
+#endif
 }
 
-bool _try_acquire_spinlock(SpinLock* lock) {
+static bool arch_try_acquire(SpinLock* lock) {
     if (!lock->locked && !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
         return true;
     } else {
@@ -13,11 +56,60 @@ bool _try_acquire_spinlock(SpinLock* lock) {
     }
 }
 
-void _acquire_spinlock(SpinLock* lock) {
-    while (!_try_acquire_spinlock(lock))
+static void arch_acquire(SpinLock* lock) {
+    while (!arch_try_acquire(lock))
         arch_yield();
 }
 
-void _release_spinlock(SpinLock* lock) {
+static void arch_release(SpinLock* lock) {
     __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
 }
+
+#endif
+
+#ifdef LOCKSTAT
+
+bool _try_acquire_spinlock(SpinLock* lock) {
+    if (!arch_try_acquire(lock))
+        return false;
+    if (lock->stat) {
+        lock->acquired_at = get_timestamp();
+        lockstat_acquired(lock->stat, false, 0);
+    }
+    return true;
+}
+
+void _acquire_spinlock(SpinLock* lock) {
+    if (!lock->stat) {
+        arch_acquire(lock);
+        return;
+    }
+    bool contended = !arch_try_acquire(lock);
+    u64 t = get_timestamp();
+    if (contended)
+        arch_acquire(lock);
+    lock->acquired_at = get_timestamp();
+    lockstat_acquired(lock->stat, contended, lock->acquired_at - t);
+}
+
+void _release_spinlock(SpinLock* lock) {
+    if (lock->stat)
+        lockstat_released(lock->stat, get_timestamp() - lock->acquired_at);
+    arch_release(lock);
+}
+
+#else
+
+bool _try_acquire_spinlock(SpinLock* lock) {
+    return arch_try_acquire(lock);
+}
+
+void _acquire_spinlock(SpinLock* lock) {
+    arch_acquire(lock);
+}
+
+void _release_spinlock(SpinLock* lock) {
+    arch_release(lock);
+}
+
+#endif
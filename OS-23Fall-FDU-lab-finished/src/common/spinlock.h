@@ -4,8 +4,26 @@
 #include <aarch64/intrinsic.h>
 #include <common/checker.h>
 
+struct lock_stat;
+
+// All zero is unlocked, so static locks need no init.
 typedef struct {
+#ifdef TICKET_SPINLOCK
+    // FIFO ticket lock. Waiters sleep in `wfe` until the owner field changes.
+    union {
+        struct {
+            volatile u32 owner; // ticket being served
+            volatile u32 next;  // next ticket to hand out
+        };
+        volatile u64 word;
+    };
+#else
     volatile bool locked;
+#endif
+#ifdef LOCKSTAT
+    struct lock_stat* stat;     // NULL if not registered
+    u64 acquired_at;            // timestamp of the current acquisition
+#endif
 } SpinLock;
 
 WARN_RESULT bool _try_acquire_spinlock(SpinLock*);
@@ -24,3 +42,11 @@ void init_spinlock(SpinLock*);
 // Release a spinlock
 #define release_spinlock(checker, lock) checker_end_ctx_after_call(checker, _release_spinlock, lock)
 
+// Give a lock a name in the contention statistics, see lockstat.h. Locks
+// registered under the same name share one record.
+#ifdef LOCKSTAT
+void lockstat_register(SpinLock*, const char* name);
+#else
+#define lockstat_register(lock, name)
+#endif
+
@@ -1,15 +1,100 @@
 #include <common/string.h>
 
+// The kernel is built with -mgeneral-regs-only, so the fast paths move
+// 16 bytes at a time with ldp/stp of general registers. Stores are 16-byte
+// aligned; loads may be unaligned since SCTLR_EL1.A is clear.
+
+// load all 64 bytes before storing any, so a chunk may overlap itself.
+static ALWAYS_INLINE void copy64(u8 *d, const u8 *s) {
+    u64 a0, a1, a2, a3, a4, a5, a6, a7;
+    asm volatile("ldp %0, %1, [%8]\n\t"
+                 "ldp %2, %3, [%8, #16]\n\t"
+                 "ldp %4, %5, [%8, #32]\n\t"
+                 "ldp %6, %7, [%8, #48]\n\t"
+                 "stp %0, %1, [%9]\n\t"
+                 "stp %2, %3, [%9, #16]\n\t"
+                 "stp %4, %5, [%9, #32]\n\t"
+                 "stp %6, %7, [%9, #48]"
+                 : "=&r"(a0), "=&r"(a1), "=&r"(a2), "=&r"(a3),
+                   "=&r"(a4), "=&r"(a5), "=&r"(a6), "=&r"(a7)
+                 : "r"(s), "r"(d)
+                 : "memory");
+}
+
+static ALWAYS_INLINE void copy16(u8 *d, const u8 *s) {
+    u64 a0, a1;
+    asm volatile("ldp %0, %1, [%2]\n\t"
+                 "stp %0, %1, [%3]"
+                 : "=&r"(a0), "=&r"(a1)
+                 : "r"(s), "r"(d)
+                 : "memory");
+}
+
+static ALWAYS_INLINE void set64(u8 *d, u64 v) {
+    asm volatile("stp %0, %0, [%1]\n\t"
+                 "stp %0, %0, [%1, #16]\n\t"
+                 "stp %0, %0, [%1, #32]\n\t"
+                 "stp %0, %0, [%1, #48]"
+                 :
+                 : "r"(v), "r"(d)
+                 : "memory");
+}
+
+static ALWAYS_INLINE void set16(u8 *d, u64 v) {
+    asm volatile("stp %0, %0, [%1]" : : "r"(v), "r"(d) : "memory");
+}
+
+// block size zeroed by one `dc zva`, or 0 if it is prohibited.
+static ALWAYS_INLINE usize dc_zva_size() {
+    u64 dczid;
+    asm volatile("mrs %0, dczid_el0" : "=r"(dczid));
+    if (dczid & 0x10)
+        return 0;
+    return 4ull << (dczid & 0xf);
+}
+
 void *memset(void *s, int c, usize n) {
-    for (usize i = 0; i < n; i++)
-        ((u8 *)s)[i] = (u8)(c & 0xff);
+    u8 *p = (u8 *)s;
+    if (n >= 16) {
+        u64 v = (u8)c * 0x0101010101010101ull;
+        while ((u64)p & 15) {
+            *p++ = (u8)c;
+            n--;
+        }
+        usize zva = v == 0 ? dc_zva_size() : 0;
+        if (zva && n >= 2 * zva) {
+            // zero whole cache lines without reading them first.
+            for (; (u64)p & (zva - 1); p += 16, n -= 16)
+                set16(p, 0);
+            for (; n >= zva; p += zva, n -= zva)
+                asm volatile("dc zva, %0" : : "r"(p) : "memory");
+        }
+        for (; n >= 64; p += 64, n -= 64)
+            set64(p, v);
+        for (; n >= 16; p += 16, n -= 16)
+            set16(p, v);
+    }
+    while (n--)
+        *p++ = (u8)c;
 
     return s;
 }
 
 void *memcpy(void *restrict dest, const void *restrict src, usize n) {
-    for (usize i = 0; i < n; i++)
-        ((u8 *)dest)[i] = ((u8 *)src)[i];
+    u8 *d = (u8 *)dest;
+    const u8 *s = (const u8 *)src;
+    if (n >= 16) {
+        while ((u64)d & 15) {
+            *d++ = *s++;
+            n--;
+        }
+        for (; n >= 64; d += 64, s += 64, n -= 64)
+            copy64(d, s);
+        for (; n >= 16; d += 16, s += 16, n -= 16)
+            copy16(d, s);
+    }
+    while (n--)
+        *d++ = *s++;
 
     return dest;
 }
@@ -27,16 +112,46 @@ int memcmp(const void *s1, const void *s2, usize n) {
 }
 
 void *memmove(void *dest, const void *src, usize n) {
-    const char *s = (const char *)src;
-    char *d = (char *)dest;
+    const u8 *s = (const u8 *)src;
+    u8 *d = (u8 *)dest;
 
     if (s < d && (usize)(d - s) < n) {
+        // copy backwards. Each chunk is loaded completely before it is
+        // stored, so it does not matter that source and destination overlap.
         s += n;
         d += n;
+        if (n >= 16) {
+            while ((u64)d & 15) {
+                *--d = *--s;
+                n--;
+            }
+            for (; n >= 64; n -= 64) {
+                d -= 64;
+                s -= 64;
+                copy64(d, s);
+            }
+            for (; n >= 16; n -= 16) {
+                d -= 16;
+                s -= 16;
+                copy16(d, s);
+            }
+        }
         while (n-- > 0) {
             *--d = *--s;
         }
     } else {
+        // forward. d <= s, so a chunk never overwrites source bytes that
+        // are not loaded yet.
+        if (n >= 16) {
+            while ((u64)d & 15) {
+                *d++ = *s++;
+                n--;
+            }
+            for (; n >= 64; d += 64, s += 64, n -= 64)
+                copy64(d, s);
+            for (; n >= 16; d += 16, s += 16, n -= 16)
+                copy16(d, s);
+        }
         while (n-- > 0) {
             *d++ = *s++;
         }
@@ -45,6 +160,39 @@ void *memmove(void *dest, const void *src, usize n) {
     return dest;
 }
 
+// byte-at-a-time reference versions.
+
+void *memset_bytes(void *s, int c, usize n) {
+    for (usize i = 0; i < n; i++)
+        ((u8 *)s)[i] = (u8)(c & 0xff);
+
+    return s;
+}
+
+void *memcpy_bytes(void *restrict dest, const void *restrict src, usize n) {
+    for (usize i = 0; i < n; i++)
+        ((u8 *)dest)[i] = ((u8 *)src)[i];
+
+    return dest;
+}
+
+void *memmove_bytes(void *dest, const void *src, usize n) {
+    const char *s = (const char *)src;
+    char *d = (char *)dest;
+
+    if (s < d && (usize)(d - s) < n) {
+        s += n;
+        d += n;
+        while (n-- > 0)
+            *--d = *--s;
+    } else {
+        while (n-- > 0)
+            *d++ = *s++;
+    }
+
+    return dest;
+}
+
 char *strncpy(char *restrict dest, const char *restrict src, usize n) {
     usize i = 0;
     for (; i < n && src[i] != '\0'; i++)
@@ -12,6 +12,11 @@ WARN_RESULT int memcmp(const void *s1, const void *s2, usize n);
 // to the same physical memory region).
 void *memmove(void *dest, const void *src, usize n);
 
+// byte-at-a-time versions of the above, kept as a reference for tests.
+void *memset_bytes(void *s, int c, usize n);
+void *memcpy_bytes(void *restrict dest, const void *restrict src, usize n);
+void *memmove_bytes(void *dest, const void *src, usize n);
+
 // note: for string functions, please specify `n` explicitly.
 
 // strncpy will `dest` with zeroes if the length of `src` is less than `n`.
@@ -8,6 +8,7 @@
 #include <kernel/sched.h>
 
 static InterruptHandler int_handler[NUM_IRQ_TYPES];
+static InterruptHandler ipi_handler;
 
 define_early_init(interrupt)
 {
@@ -26,10 +27,37 @@ void set_interrupt_handler(InterruptType type, InterruptHandler handler)
     int_handler[type] = handler;
 }
 
+// take IPIs on mailbox 0 of this cpu.
+void init_ipi()
+{
+    device_put_u32(MBOX_RDCLR(cpuid(), 0), ~0u);
+    device_put_u32(MBOX_INT_CTRL(cpuid()), MBOX_INT_MBOX0);
+}
+
+void send_ipi(int cpu)
+{
+    arch_dsb_sy();
+    device_put_u32(MBOX_SET(cpu, 0), 1);
+}
+
+void set_ipi_handler(InterruptHandler handler)
+{
+    ipi_handler = handler;
+}
+
 void interrupt_global_handler()
 {
     u32 source = device_get_u32(IRQ_SRC_CORE(cpuid()));
 
+    if (source & IRQ_SRC_MBOX0)
+    {
+        source ^= IRQ_SRC_MBOX0;
+        // clear first, so an IPI sent while the handler runs is not lost
+        device_put_u32(MBOX_RDCLR(cpuid(), 0), ~0u);
+        if (ipi_handler)
+            ipi_handler();
+    }
+
     if (source & IRQ_SRC_CNTPNSIRQ)
     {
         source ^= IRQ_SRC_CNTPNSIRQ;
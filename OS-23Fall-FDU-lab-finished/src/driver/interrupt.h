@@ -14,3 +14,7 @@ typedef void (*InterruptHandler)();
 
 void interrupt_global_handler();
 void set_interrupt_handler(InterruptType type, InterruptHandler handler);
+
+void init_ipi();
+void send_ipi(int cpu);
+void set_ipi_handler(InterruptHandler handler);
@@ -22,6 +22,7 @@
 #define IRQ_SRC_TIMER       (1 << 11) /* Local Timer */
 #define IRQ_SRC_GPU         (1 << 8)
 #define IRQ_SRC_CNTPNSIRQ   (1 << 1) /* Core Timer */
+#define IRQ_SRC_MBOX0       (1 << 4) /* Mailbox 0 */
 #define FIQ_SRC_CORE(i)   (LOCAL_BASE + 0x70 + 4 * (i))
 
 /* Local timer */
@@ -37,6 +38,12 @@
 #define TIMER_CLR_INT (1 << 31)
 #define TIMER_RELOAD  (1 << 30)
 
+/* Core Mailboxes, mailbox 0 of every core is used for IPIs */
+#define MBOX_INT_CTRL(i)  (LOCAL_BASE + 0x50 + 4 * (i))
+#define MBOX_INT_MBOX0    (1 << 0)
+#define MBOX_SET(i, n)    (LOCAL_BASE + 0x80 + 16 * (i) + 4 * (n))
+#define MBOX_RDCLR(i, n)  (LOCAL_BASE + 0xC0 + 16 * (i) + 4 * (n))
+
 /* Core Timer */
 #define CORE_TIMER_CTRL(i) (LOCAL_BASE + 0x40 + 4 * (i))
 #define CORE_TIMER_ENABLE  (1 << 1) /* CNTPNSIRQ */
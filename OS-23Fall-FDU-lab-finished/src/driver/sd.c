@@ -88,6 +88,7 @@ void sd_init() {
     printk("lba blocksize: %d\n", blocksize);
     queue_init(&buf_queue);
     init_spinlock(&sdlock);
+    lockstat_register(&sdlock, "sdlock");
 
     
     
@@ -42,6 +42,11 @@ static SpinLock lock;
  */
 static ListNode head;
 
+/**
+    @brief the object cache of in-memory blocks.
+ */
+static struct kmem_cache* block_cache;
+
 static LogHeader header; // in-memory copy of log header block.
 SpinLock loglock;
 /**
@@ -63,7 +68,7 @@ struct {
     int committing;
     int outstanding; 
     Semaphore busy;
-    SleepLock lock;
+    WaitQueue wait;     // begin_op waiting for room in the log, exclusive
 } log;
 
 // read the content from disk.
@@ -94,6 +99,7 @@ static void init_block(Block *block) {
     block->pinned = false;
 
     init_sleeplock(&block->lock);
+    lockstat_register_sleeplock(&block->lock, "block");
     block->valid = false;
     memset(block->data, 0, sizeof(block->data));
 }
@@ -150,7 +156,7 @@ static Block *cache_acquire(usize block_no) {
         }
     }
     // printk("cache_acquire: no available buffers");
-    Block* b = kalloc(sizeof(Block));
+    Block* b = kmem_cache_alloc(block_cache);
     init_block(b);
     b->block_no = block_no;
     b->acquired = true;
@@ -183,7 +189,7 @@ static void cache_release(Block *block) {
     _detach_from_list(&block->node);
 
     if(!block->pinned && get_num_cached_blocks() > EVICTION_THRESHOLD){    
-        kfree(block);
+        kmem_cache_free(block_cache, block);
     }else{
         _insert_into_list(&head, &block->node);
     }
@@ -212,12 +218,14 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     device = _device;
 
     init_spinlock(&lock);
+    lockstat_register(&lock, "bcache");
     init_list_node(&head);
+    block_cache = kmem_cache_create("block", sizeof(Block), 8, NULL);
 
     // Initialize all buffer blocks
     for (int i = 0; i < EVICTION_THRESHOLD; i++) {
         // Block* b = &buf[i];
-        Block* b = kalloc(sizeof(Block));
+        Block* b = kmem_cache_alloc(block_cache);
         init_block(b);
         _insert_into_list(&head, &b->node);
     }
@@ -225,7 +233,8 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     log.committing = 0;
     log.outstanding = 0;
     init_spinlock(&loglock);
-    init_sleeplock(&log.lock);
+    init_waitqueue(&log.wait);
+    lockstat_register(&loglock, "loglock");
     read_header();
     recover_from_log();
     // TODO
@@ -236,26 +245,16 @@ static void cache_begin_op(OpContext *ctx) {
     // TODO
     // printk("begin op\n");
     if(!ctx) PANIC();
-    while(1){
-        setup_checker(0);
-        _acquire_spinlock(&loglock);
-        if(log.committing){
-            // printk("op commiting\n");
-            _release_spinlock(&loglock);
-            ASSERT(acquire_sleeplock(0, &log.lock));
-        }else if(header.num_blocks + (log.outstanding+1)*OP_MAX_NUM_BLOCKS > LOG_MAX_SIZE){
-            // printk("op too many blocks\n");
-            _release_spinlock(&loglock);
-            ASSERT(acquire_sleeplock(0, &log.lock));
-        } else {
-            // printk("op begins\n");
-            log.outstanding += 1;
-            ctx->rm = OP_MAX_NUM_BLOCKS;
-            _release_spinlock(&loglock);
-            break;
-        }
-        checker_end_ctx(0);
+    _acquire_spinlock(&loglock);
+    // wait while committing, or if this op might exhaust the log space
+    while(log.committing ||
+          header.num_blocks + (log.outstanding+1)*OP_MAX_NUM_BLOCKS > LOG_MAX_SIZE){
+        unalertable_wait_queue_exclusive(&log.wait, &loglock);
     }
+    // printk("op begins\n");
+    log.outstanding += 1;
+    ctx->rm = OP_MAX_NUM_BLOCKS;
+    _release_spinlock(&loglock);
 }
 
 
@@ -332,7 +331,8 @@ static void cache_end_op(OpContext *ctx) {
         do_commit = 1;
         log.committing = 1;
     } else {
-        post_all_sem(&log.lock);
+        // our reservation is free, that is room for one more op
+        wake_up_one(&log.wait);
     }
     _release_spinlock(&loglock);
 
@@ -343,7 +343,8 @@ static void cache_end_op(OpContext *ctx) {
         _acquire_spinlock(&loglock);
         commit();
         log.committing = 0;
-        post_all_sem(&log.lock);
+        // the log is empty, wake as many ops as fit in it
+        wake_up(&log.wait, LOG_MAX_SIZE / OP_MAX_NUM_BLOCKS);
         _release_spinlock(&loglock);
     }
 
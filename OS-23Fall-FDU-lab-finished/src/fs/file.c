@@ -15,6 +15,7 @@ void init_ftable() {
         ftable.files[i].type = FD_NONE;
     }
     init_spinlock(&ftable.lock);
+    lockstat_register(&ftable.lock, "ftable");
 }
 
 void init_oftable(struct oftable *oftable) {
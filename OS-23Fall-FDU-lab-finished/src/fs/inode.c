@@ -1,3 +1,4 @@
+#include <common/rcu.h>
 #include <common/string.h>
 #include <fs/inode.h>
 #include <kernel/mem.h>
@@ -26,6 +27,10 @@ static const BlockCache* cache;
     Use it to protect anything you need.
 
     e.g. the list of allocated blocks, ref counts, etc.
+
+    Lookups in `inode_get` walk the list under RCU and take no lock.
+    Ref counts are atomic, and the last put of an unlinked inode takes its
+    count from 1 to 0, so that such a lookup cannot take it back.
  */
 static SpinLock lock;
 
@@ -40,6 +45,11 @@ static SpinLock lock;
  */
 static ListNode head;
 
+/**
+    @brief the object cache of in-memory inodes.
+ */
+static struct kmem_cache* inode_cache;
+
 
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
@@ -59,7 +69,9 @@ static INLINE u32* get_addrs(Block* block) {
 // initialize inode tree.
 void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
     init_spinlock(&lock);
+    lockstat_register(&lock, "icache");
     init_list_node(&head);
+    inode_cache = kmem_cache_create("inode", sizeof(Inode), 8, NULL);
     sblock = _sblock;
     cache = _cache;
 
@@ -72,6 +84,7 @@ void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
 // initialize in-memory inode.
 static void init_inode(Inode* inode) {
     init_sleeplock(&inode->lock);
+    lockstat_register_sleeplock(&inode->lock, "inode");
     init_rc(&inode->rc);
     init_list_node(&inode->node);
     inode->inode_no = 0;
@@ -158,9 +171,20 @@ static void inode_sync(OpContext* ctx, Inode* inode, bool do_write) {
 static Inode* inode_get(usize inode_no) {
     ASSERT(inode_no > 0);
     ASSERT(inode_no < sblock->num_inodes);
-    _acquire_spinlock(&lock);
     // TODO
     Inode* inode;
+    rcu_read_lock();
+    rcu_for_in_list(p, &head) {
+        inode = container_of(p, Inode, node);
+        if (inode->inode_no == inode_no && _try_increment_rc(&inode->rc)) {
+            rcu_read_unlock();
+            return inode;
+        }
+    }
+    rcu_read_unlock();
+    // not cached, unused or being freed: look again under the lock,
+    // somebody may have added it meanwhile
+    _acquire_spinlock(&lock);
     _for_in_list(p, &head) {
         if(p == &head) continue;
         inode = container_of(p, Inode, node);
@@ -170,11 +194,11 @@ static Inode* inode_get(usize inode_no) {
             return inode;
         }
     }
-    inode = (Inode*)kalloc(sizeof(Inode));
+    inode = (Inode*)kmem_cache_alloc(inode_cache);
     init_inode(inode);
     inode->inode_no = inode_no;
     _increment_rc(&inode->rc);
-    _insert_into_list(&head, &inode->node);
+    rcu_insert_into_list(&head, &inode->node);
     _release_spinlock(&lock);
     return inode;
 }
@@ -211,21 +235,26 @@ static void inode_clear(OpContext* ctx, Inode* inode) {
 // see `inode.h`.
 static Inode* inode_share(Inode* inode) {
     // TODO
-    _acquire_spinlock(&lock);
+    // the caller holds a reference, so it cannot be freed meanwhile
     _increment_rc(&inode->rc);
-    _release_spinlock(&lock);
     return inode;
 }
 
+// a lockless lookup may still be looking at it until now.
+static void inode_free(struct rcu_head* head) {
+    kmem_cache_free(inode_cache, container_of(head, Inode, rcu));
+}
+
 // see `inode.h`.
 static void inode_put(OpContext* ctx, Inode* inode) {
     // TODO
     Block *b;
     InodeEntry* entry;
     _acquire_spinlock(&lock);
+    isize last = 1;
     if(inode->entry.num_links == 0){
-        int r = inode->rc.count;
-        if(r == 1){
+        if(__atomic_compare_exchange_n(&inode->rc.count, &last, 0, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
             inode_clear(ctx, inode);
             b = cache->acquire(sblock->inode_start + inode->inode_no / INODE_PER_BLOCK);
             entry = (InodeEntry*)(b->data) + inode->inode_no % INODE_PER_BLOCK;
@@ -233,8 +262,8 @@ static void inode_put(OpContext* ctx, Inode* inode) {
             cache->sync(ctx, b);
             cache->release(b);
             inode->valid = false;
-            _detach_from_list(&inode->node);
-            kfree(inode);
+            rcu_detach_from_list(&inode->node);
+            call_rcu(&inode->rcu, inode_free);
             _release_spinlock(&lock);
             return;
         }
@@ -1,6 +1,7 @@
 #pragma once
 #include <common/list.h>
 #include <common/rc.h>
+#include <common/rcu.h>
 #include <common/spinlock.h>
 #include <fs/cache.h>
 #include <fs/defines.h>
@@ -41,6 +42,13 @@ typedef struct {
      */
     ListNode node;
 
+    /**
+        @brief defers freeing the inode until lockless lookups are done.
+
+        @see inode_get
+     */
+    struct rcu_head rcu;
+
     /**
         @brief the corresponding inode number on disk.
 
@@ -1,4 +1,5 @@
 #include <kernel/mem.h>
+#include <kernel/proc.h>
 #include <kernel/sched.h>
 #include <fs/pipe.h>
 #include <common/string.h>
@@ -6,15 +7,21 @@
 int pipeAlloc(File** f0, File** f1) {
     // TODO
 
-    Pipe *p = kalloc();
+    Pipe *p = kalloc(sizeof(Pipe));
     if (p == 0) {
         return -1; // Allocation failed
     }
+    p->data = kalloc_pages(PIPE_ORDER);
+    if (p->data == 0) {
+        kfree(p);
+        return -1;
+    }
     
     // Initialize the pipe
     init_spinlock(&p->lock);
-    init_sem(&p->wlock, 0);
-    init_sem(&p->rlock, 0);
+    lockstat_register(&p->lock, "pipe");
+    init_waitqueue(&p->wwait);
+    init_waitqueue(&p->rwait);
     p->nread = p->nwrite = 0;
     p->readopen = p->writeopen = 1;
     // Allocate two file structures for the read and write ends of the pipe
@@ -24,6 +31,7 @@ int pipeAlloc(File** f0, File** f1) {
         // Cleanup if allocation failed
         if (*f0) file_close(*f0);
         if (*f1) file_close(*f1);
+        kfree_pages(p->data, PIPE_ORDER);
         kfree(p);
         return -1;
     }
@@ -49,14 +57,15 @@ void pipeClose(Pipe* pi, int writable) {
     
     if (writable) {
         pi->writeopen = 0;
-        post_all_sem(&pi->rlock); // Wake up any blocked readers
+        wake_up_all(&pi->rwait); // every reader has to see the end
     } else {
         pi->readopen = 0;
-        post_all_sem(&pi->wlock); // Wake up any blocked writers
+        wake_up_all(&pi->wwait); // Wake up any blocked writers
     }
     
     if (pi->readopen == 0 && pi->writeopen == 0) {
         _release_spinlock(&pi->lock);
+        kfree_pages(pi->data, PIPE_ORDER);
         kfree(pi); // Assuming freePipe frees the Pipe structure
     } else {
         _release_spinlock(&pi->lock);
@@ -64,42 +73,56 @@ void pipeClose(Pipe* pi, int writable) {
 
 }
 
+// Readers and writers wait exclusively, and each side wakes one process
+// of the other side when it has made progress, not one per byte. A woken
+// process may leave data or room behind for the next one, so it passes
+// the wakeup on before it returns.
+
 int pipeWrite(Pipe* pi, u64 addr, int n) {
     // TODO
 
+    int i = 0;
     _acquire_spinlock(&pi->lock);
-    for (int i = 0; i < n; i++) {
-        // Wait if the pipe is full
-        while ((pi->nwrite == (pi->nread + PIPESIZE)) && pi->readopen) {
-            wait_sem(&pi->wlock);
-        }
-        if (!pi->readopen) {
-            _release_spinlock(&pi->lock);
-            return -1; // Read end is closed
+    while (i < n) {
+        if (!pi->readopen || thisproc()->killed)
+            break; // Read end is closed
+        if (pi->nwrite == pi->nread + PIPESIZE) {
+            // full: let a reader drain it while we sleep
+            wake_up_one(&pi->rwait);
+            wait_queue_exclusive(&pi->wwait, &pi->lock);
+            continue;
         }
-        pi->data[pi->nwrite++ % PIPESIZE] = ((char*)addr)[i];
-        post_all_sem(&pi->rlock); // Wake up any blocked readers
+        pi->data[pi->nwrite++ % PIPESIZE] = ((char*)addr)[i++];
     }
+    if (i > 0)
+        wake_up_one(&pi->rwait);
+    if (pi->nwrite != pi->nread + PIPESIZE)
+        wake_up_one(&pi->wwait);
     _release_spinlock(&pi->lock);
-    return n;
+    return i == n ? n : -1;
 }
 
 int pipeRead(Pipe* pi, u64 addr, int n) {
     // TODO
 
+    int i = 0;
     _acquire_spinlock(&pi->lock);
-    int i;
-    for (i = 0; i < n; i++) {
-        // Wait if the pipe is empty
-        while ((pi->nread == pi->nwrite) && pi->writeopen) {
-            wait_sem(&pi->rlock);
+    while (i < n) {
+        if (pi->nread != pi->nwrite) {
+            ((char*)addr)[i++] = pi->data[pi->nread++ % PIPESIZE];
+            continue;
         }
-        if (pi->nread == pi->nwrite) {
+        if (!pi->writeopen || thisproc()->killed)
             break; // Pipe is empty and write end is closed
-        }
-        ((char*)addr)[i] = pi->data[pi->nread++ % PIPESIZE];
-        post_all_sem(&pi->wlock); // Wake up any blocked writers
+        // empty: let a writer fill it while we sleep
+        wake_up_one(&pi->wwait);
+        wait_queue_exclusive(&pi->rwait, &pi->lock);
     }
+    int ret = i < n && pi->writeopen ? -1 : i; // killed
+    if (i > 0)
+        wake_up_one(&pi->wwait);
+    if (pi->nread != pi->nwrite)
+        wake_up_one(&pi->rwait);
     _release_spinlock(&pi->lock);
-    return i; // Number of bytes read
+    return ret; // Number of bytes read
 }
\ No newline at end of file
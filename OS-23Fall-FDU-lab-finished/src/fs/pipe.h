@@ -1,14 +1,17 @@
 #ifndef _PIPE_H
 #define _PIPE_H
+#include <aarch64/mmu.h>
 #include <common/spinlock.h>
 #include <common/defines.h>
 #include <fs/file.h>
 #include <common/sem.h>
-#define PIPESIZE 512
+#define PIPE_ORDER 1    // the ring buffer is a buddy block of 2^PIPE_ORDER pages
+#define PIPESIZE (PAGE_SIZE << PIPE_ORDER)
 typedef struct pipe {
     SpinLock lock;
-    Semaphore wlock,rlock;
-    char data[PIPESIZE];
+    WaitQueue wwait;    // writers waiting for room, exclusive
+    WaitQueue rwait;    // readers waiting for data, exclusive
+    char *data;
     u32 nread;  // number of bytes read
     u32 nwrite;  // number of bytes written
     int readopen;  // read fd is still open
@@ -18,4 +18,27 @@ void* kalloc(isize x) {
 void kfree(void* object) {
     free(object);
 }
+
+struct kmem_cache {
+    usize size;
+    void (*ctor)(void*);
+};
+
+struct kmem_cache* kmem_cache_create(const char* name [[maybe_unused]],
+                                     usize size,
+                                     usize align [[maybe_unused]],
+                                     void (*ctor)(void*)) {
+    return new kmem_cache{size, ctor};
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    void* object = malloc(cache->size);
+    if (cache->ctor)
+        cache->ctor(object);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache* cache [[maybe_unused]], void* object) {
+    free(object);
+}
 }
@@ -164,4 +164,44 @@ int post_all_sem(Semaphore* x)
 #undef sa
 #undef sb
 
+// the callers check their condition again after every wakeup, so waking
+// up now and then is enough here.
+struct WaitQueue;
+void init_waitqueue(WaitQueue* wq [[maybe_unused]]) {}
+bool _wait_queue(WaitQueue* wq [[maybe_unused]], struct SpinLock* lock,
+                 bool exclusive [[maybe_unused]], bool alertable [[maybe_unused]]) {
+    _release_spinlock(lock);
+    usleep(5);
+    _acquire_spinlock(lock);
+    return true;
+}
+int wake_up(WaitQueue* wq [[maybe_unused]], int nr_exclusive [[maybe_unused]]) {
+    return 0;
+}
+
+// readers are serialized too, the tests only check for correctness.
+struct RWLock;
+void init_rwlock(RWLock* rw) {
+    init_spinlock((SpinLock*)rw, "");
+}
+void _acquire_read_lock(RWLock* rw) {
+    _acquire_spinlock((SpinLock*)rw);
+}
+void _release_read_lock(RWLock* rw) {
+    _release_spinlock((SpinLock*)rw);
+}
+void _acquire_write_lock(RWLock* rw) {
+    _acquire_spinlock((SpinLock*)rw);
+}
+void _release_write_lock(RWLock* rw) {
+    _release_spinlock((SpinLock*)rw);
+}
+
+// there are no grace periods here: objects handed to call_rcu() are never
+// freed, so a lockless reader can never see freed memory.
+struct rcu_head;
+void rcu_read_lock() {}
+void rcu_read_unlock() {}
+void call_rcu(rcu_head* head [[maybe_unused]], void (*func)(rcu_head*) [[maybe_unused]]) {}
+
 }
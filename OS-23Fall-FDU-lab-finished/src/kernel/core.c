@@ -1,5 +1,7 @@
+#include <common/rcu.h>
 #include <kernel/cpu.h>
 #include <kernel/init.h>
+#include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/sched.h>
 #include <test/test.h>
@@ -12,6 +14,11 @@ NO_RETURN void idle_entry() {
         yield();
         if (panic_flag)
             break;
+        // zero a page between yields, so runnable work waits for at most
+        // one page; sleep only when the pool is full.
+        if (fill_zero_pool())
+            continue;
+        rcu_run_callbacks();
         arch_with_trap { arch_wfi(); }
     }
     set_cpu_off();
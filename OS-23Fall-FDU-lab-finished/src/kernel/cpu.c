@@ -2,80 +2,103 @@
 #include <kernel/printk.h>
 #include <kernel/init.h>
 #include <driver/clock.h>
+#include <driver/interrupt.h>
 #include <kernel/sched.h>
 #include <kernel/proc.h>
+#include <kernel/schedtrace.h>
 #include <aarch64/mmu.h>
 
 struct cpu cpus[NCPU];
 
-static bool __timer_cmp(rb_node lnode, rb_node rnode)
-{
-    i64 d = container_of(lnode, struct timer, _node)->_key - container_of(rnode, struct timer, _node)->_key;
-    if (d < 0)
-        return true;
-    if (d == 0)
-        return lnode < rnode;
-    return false;
-}
+static u64 max_countdown_ms;        // reset_clock() takes less than 2^31 ticks
+
+// A timer belongs to the wheel of the cpu that set it. Other cpus may
+// cancel it, so each wheel has a lock; the clock is only programmed by its
+// own cpu. Handlers run without the lock held.
 
+// program the clock for the next thing the timer wheel of this cpu has to
+// do: a timer to fire or a slot to cascade. caller holds timer_lock.
 static void __timer_set_clock()
 {
-    auto node = _rb_first(&cpus[cpuid()].timer);
-    if (!node)
+    struct cpu* c = &cpus[cpuid()];
+    u64 t1 = timer_wheel_next(&c->timer);
+    c->clock_at = t1;
+    if (t1 == WHEEL_NONE)
     {
-        reset_clock(1000);
+        // nothing to wait for, sleep until an interrupt from somewhere else
+        stop_clock();
         return;
     }
-    auto t1 = container_of(node, struct timer, _node)->_key;
     auto t0 = get_timestamp_ms();
     if (t1 <= t0)
         reset_clock(0);
     else
-        reset_clock(t1 - t0);
+        reset_clock(MIN(t1 - t0, max_countdown_ms));
 }
 
 static void timer_clock_handler() {
-    reset_clock(1000);
     // printk("cpu %d aha\n", cpuid());
-    while (1)
+    struct cpu* c = &cpus[cpuid()];
+    struct timer* timer;
+    _acquire_spinlock(&c->timer_lock);
+    // one at a time: a handler may switch to another process, which then
+    // finds the rest still on the wheel.
+    while ((timer = timer_wheel_expire(&c->timer, get_timestamp_ms())) != NULL)
     {
-        auto node = _rb_first(&cpus[cpuid()].timer);
-        if (!node)
-            break;
-        auto timer = container_of(node, struct timer, _node);
-        if (get_timestamp_ms() < timer->_key)
-            break;
-        cancel_cpu_timer(timer);
         timer->triggered = true;
+        timer->_running = true;
+        _release_spinlock(&c->timer_lock);
+        SCHED_TRACE_EVENT(TRACE_TIMER, TRACE_PID(thisproc()),
+                    (int)(get_timestamp_ms() - timer->_key), timer->elapse);
         timer->handler(timer);
+        // the last access, cancel_cpu_timer() may free the timer after it
+        __atomic_store_n(&timer->_running, false, __ATOMIC_RELEASE);
+        // we may have been switched out and come back on another cpu
+        c = &cpus[cpuid()];
+        _acquire_spinlock(&c->timer_lock);
     }
+    __timer_set_clock();
+    _release_spinlock(&c->timer_lock);
 }
 
 define_early_init(clock_handler) {
+    max_countdown_ms = 0x7fffffff / (get_clock_frequency() / 1000);
+    for (int i = 0; i < NCPU; i++)
+    {
+        init_spinlock(&cpus[i].timer_lock);
+        lockstat_register(&cpus[i].timer_lock, "timer");
+    }
     set_clock_handler(&timer_clock_handler);
 }
 
 void set_cpu_timer(struct timer* timer)
 {
+    struct cpu* c = &cpus[cpuid()];
     timer->triggered = false;
-    timer->_key = get_timestamp_ms() + timer->elapse;
-    ASSERT(0 == _rb_insert(&timer->_node, &cpus[cpuid()].timer, __timer_cmp));
-    __timer_set_clock();
+    timer->_running = false;
+    timer->_cpu = cpuid();
+    u64 now = get_timestamp_ms();
+    timer->_key = now + timer->elapse;
+    _acquire_spinlock(&c->timer_lock);
+    timer_wheel_add(&c->timer, timer, now);
+    if (timer->_key < c->clock_at)
+        __timer_set_clock();
+    _release_spinlock(&c->timer_lock);
 }
 
+// may be called on any cpu. if the timer has fired already, wait for its
+// handler to return, so the caller can free it; timer->triggered tells
+// which case it was. the clock is left as it is: if it was set for this
+// timer, the interrupt finds nothing to do and programs it again.
 void cancel_cpu_timer(struct timer* timer)
 {
-    ASSERT(!timer->triggered);
-    _rb_erase(&timer->_node, &cpus[cpuid()].timer);
-    __timer_set_clock();
-}
-
-static struct timer hello_timer[4];
-static void hello(struct timer* t)
-{
-    printk("CPU %d: living\n", cpuid());
-    t->data++;
-    set_cpu_timer(&hello_timer[cpuid()]);
+    struct cpu* c = &cpus[timer->_cpu];
+    _acquire_spinlock(&c->timer_lock);
+    if (!timer->triggered)
+        timer_wheel_del(&c->timer, timer);
+    _release_spinlock(&c->timer_lock);
+    while (__atomic_load_n(&timer->_running, __ATOMIC_ACQUIRE))
+        ;
 }
 
 void set_cpu_on() {
@@ -87,11 +110,12 @@ void set_cpu_on() {
     arch_set_vbar(exception_vector);
     arch_reset_esr();
     init_clock();
+    init_timer_wheel(&cpus[cpuid()].timer, get_timestamp_ms());
+    // init_clock() set the clock for 1 s from now
+    cpus[cpuid()].clock_at = get_timestamp_ms() + 1000;
+    init_ipi();
     cpus[cpuid()].online = true;
     printk("CPU %d: hello\n", cpuid());
-    hello_timer[cpuid()].elapse = 5000;
-    hello_timer[cpuid()].handler = hello;
-    set_cpu_timer(&hello_timer[cpuid()]);
 }
 
 void set_cpu_off() {
@@ -1,24 +1,17 @@
 #pragma once
 
 #include <kernel/schinfo.h>
-#include <common/rbtree.h>
+#include <kernel/timer.h>
 
 #define NCPU 4
-
-struct timer
-{
-    bool triggered;
-    int elapse;
-    u64 _key;
-    struct rb_node_ _node;
-    void (*handler)(struct timer*);
-    u64 data;
-};
+#define CPU_MASK_ALL ((1u << NCPU) - 1)
 
 struct cpu
 {
     bool online;
-    struct rb_root_ timer;
+    SpinLock timer_lock;
+    struct timer_wheel timer;
+    u64 clock_at;       // when the clock interrupt is due, WHEEL_NONE if off
     struct sched sched;
 };
 
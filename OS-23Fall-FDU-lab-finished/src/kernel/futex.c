@@ -0,0 +1,216 @@
+#include <aarch64/mmu.h>
+#include <common/list.h>
+#include <common/lockstat.h>
+#include <errno.h>
+#include <kernel/cpu.h>
+#include <kernel/futex.h>
+#include <kernel/init.h>
+#include <kernel/paging.h>
+#include <kernel/proc.h>
+#include <kernel/pt.h>
+#include <kernel/sched.h>
+
+#define FUTEX_HASH_BITS 6
+#define NR_FUTEX_BUCKETS (1 << FUTEX_HASH_BITS)
+
+// lives on the stack of the waiting process, see futex_wait().
+struct futex_waiter {
+    ListNode node;
+    u64 key;                // physical address of the word
+    u32 bitset;
+    struct proc* proc;
+    bool woken;
+};
+
+static struct futex_bucket {
+    SpinLock lock;
+    ListNode waiters;       // oldest first
+} futex_queues[NR_FUTEX_BUCKETS];
+
+define_early_init(futex)
+{
+    for (int i = 0; i < NR_FUTEX_BUCKETS; i++) {
+        init_spinlock(&futex_queues[i].lock);
+        lockstat_register(&futex_queues[i].lock, "futex");
+        init_list_node(&futex_queues[i].waiters);
+    }
+}
+
+static struct futex_bucket* bucket_of(u64 key)
+{
+    return &futex_queues[(key * 0x9e3779b97f4a7c15ull) >> (64 - FUTEX_HASH_BITS)];
+}
+
+static u64 user_pa(u64 va)
+{
+    struct pgdir* pd = &thisproc()->pgdir;
+    _acquire_spinlock(&pd->lock);
+    PTEntriesPtr pte = get_pte(pd, va, false);
+    u64 pa = pte && (*pte & PTE_VALID) ? PTE_ADDRESS(*pte) + VA_OFFSET(va) : 0;
+    _release_spinlock(&pd->lock);
+    return pa;
+}
+
+// the physical address of the word, 0 if it is in no section. a heap page
+// that was never touched is mapped first, as the fault would.
+static u64 futex_key(u32* uaddr)
+{
+    u64 va = (u64)uaddr;
+    if ((va & KSPACE_MASK) == KSPACE_MASK)
+        return K2P(va);
+    u64 pa = user_pa(va);
+    if (pa == 0 && fault_in_page(va) == 0)
+        pa = user_pa(va);
+    return pa;
+}
+
+// a requeue moves a waiter to another bucket while it holds the locks of
+// both, so the key is stable once the lock of its bucket is held.
+static struct futex_bucket* lock_waiter_bucket(struct futex_waiter* w)
+{
+    while (1) {
+        u64 key = __atomic_load_n(&w->key, __ATOMIC_RELAXED);
+        struct futex_bucket* b = bucket_of(key);
+        _acquire_spinlock(&b->lock);
+        if (w->key == key)
+            return b;
+        _release_spinlock(&b->lock);
+    }
+}
+
+static void lock_two_buckets(struct futex_bucket* b1, struct futex_bucket* b2)
+{
+    if (b1 > b2) {
+        struct futex_bucket* t = b1;
+        b1 = b2;
+        b2 = t;
+    }
+    _acquire_spinlock(&b1->lock);
+    if (b2 != b1)
+        _acquire_spinlock(&b2->lock);
+}
+
+static void unlock_two_buckets(struct futex_bucket* b1, struct futex_bucket* b2)
+{
+    if (b2 != b1)
+        _release_spinlock(&b2->lock);
+    _release_spinlock(&b1->lock);
+}
+
+static void futex_timer_handler(struct timer* t)
+{
+    activate_proc((struct proc*)t->data);
+}
+
+int futex_wait(u32* uaddr, u32 val, u32 bitset, u64 timeout_ms)
+{
+    if (((u64)uaddr & 3) || bitset == 0)
+        return -EINVAL;
+    u64 key = futex_key(uaddr);
+    if (key == 0)
+        return -EFAULT;
+    struct futex_waiter w;
+    w.key = key;
+    w.bitset = bitset;
+    w.proc = thisproc();
+    w.woken = false;
+    struct futex_bucket* b = bucket_of(key);
+    _acquire_spinlock(&b->lock);
+    // a waker stores to the word before it takes this lock, so either we
+    // see the new value here or it finds us on the list.
+    if (__atomic_load_n((u32*)P2K(key), __ATOMIC_ACQUIRE) != val) {
+        _release_spinlock(&b->lock);
+        return -EAGAIN;
+    }
+    if (timeout_ms == 0) {
+        _release_spinlock(&b->lock);
+        return -ETIMEDOUT;
+    }
+    _insert_into_list(b->waiters.prev, &w.node);
+    struct timer t;
+    bool timed = timeout_ms != FUTEX_NO_TIMEOUT;
+    _acquire_sched_lock();
+    if (timed) {
+        // elapse is an int, longer timeouts end after about 12 days
+        t.elapse = (int)MIN(timeout_ms, (u64)(1 << 30));
+        t.handler = futex_timer_handler;
+        t.data = (u64)thisproc();
+        set_cpu_timer(&t);
+    }
+    _release_spinlock(&b->lock);
+    _sched(SLEEPING);
+    if (timed)
+        cancel_cpu_timer(&t);
+    b = lock_waiter_bucket(&w);
+    bool woken = w.woken;
+    if (!woken)
+        _detach_from_list(&w.node);
+    _release_spinlock(&b->lock);
+    if (woken)
+        return 0;
+    return timed && t.triggered ? -ETIMEDOUT : -EINTR;
+}
+
+// b is locked. The waiter may return as soon as b is unlocked, so do not
+// touch it after that.
+static int wake_waiters(struct futex_bucket* b, u64 key, int nr, u32 bitset)
+{
+    int n = 0;
+    ListNode* p = b->waiters.next;
+    while (p != &b->waiters && n < nr) {
+        struct futex_waiter* w = container_of(p, struct futex_waiter, node);
+        p = p->next;
+        if (w->key != key || !(w->bitset & bitset))
+            continue;
+        _detach_from_list(&w->node);
+        w->woken = true;
+        activate_proc(w->proc);
+        n++;
+    }
+    return n;
+}
+
+int futex_wake(u32* uaddr, int nr, u32 bitset)
+{
+    if (((u64)uaddr & 3) || bitset == 0)
+        return -EINVAL;
+    u64 key = futex_key(uaddr);
+    if (key == 0)
+        return -EFAULT;
+    struct futex_bucket* b = bucket_of(key);
+    _acquire_spinlock(&b->lock);
+    int n = wake_waiters(b, key, nr, bitset);
+    _release_spinlock(&b->lock);
+    return n;
+}
+
+int futex_requeue(u32* uaddr, int nr_wake, int nr_requeue, u32* uaddr2,
+                  const u32* cmpval)
+{
+    if (((u64)uaddr & 3) || ((u64)uaddr2 & 3) || nr_wake < 0 || nr_requeue < 0)
+        return -EINVAL;
+    u64 key = futex_key(uaddr), key2 = futex_key(uaddr2);
+    if (key == 0 || key2 == 0)
+        return -EFAULT;
+    struct futex_bucket *b = bucket_of(key), *b2 = bucket_of(key2);
+    lock_two_buckets(b, b2);
+    if (cmpval && __atomic_load_n((u32*)P2K(key), __ATOMIC_ACQUIRE) != *cmpval) {
+        unlock_two_buckets(b, b2);
+        return -EAGAIN;
+    }
+    int n = wake_waiters(b, key, nr_wake, FUTEX_BITSET_MATCH_ANY);
+    int moved = 0;
+    ListNode* p = b->waiters.next;
+    while (p != &b->waiters && moved < nr_requeue) {
+        struct futex_waiter* w = container_of(p, struct futex_waiter, node);
+        p = p->next;
+        if (w->key != key)
+            continue;
+        _detach_from_list(&w->node);
+        __atomic_store_n(&w->key, key2, __ATOMIC_RELAXED);
+        _insert_into_list(b2->waiters.prev, &w->node);
+        moved++;
+    }
+    unlock_two_buckets(b, b2);
+    return n + moved;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <common/defines.h>
+
+// Fast user-space locking: a process sleeps on a 32-bit word until another
+// one wakes it, see futex(2). Waiters are found by the physical address of
+// the word, so processes that share the page find each other. Kernel
+// threads can use these on kernel addresses too.
+//
+// The functions return 0 or the number of processes woken on success, and
+// a negated errno value on failure, as the syscall does.
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 3
+#define FUTEX_CMP_REQUEUE 4
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_CLOCK_REALTIME 256
+#define FUTEX_CMD_MASK (~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME))
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
+#define FUTEX_NO_TIMEOUT ((u64)-1)
+
+// sleep if *uaddr is still val, until a wake with a bitset that shares a
+// bit with ours. -EAGAIN if the value had changed, -ETIMEDOUT after
+// timeout_ms, -EINTR if the process was alerted.
+int futex_wait(u32* uaddr, u32 val, u32 bitset, u64 timeout_ms);
+// wake up to nr waiters on uaddr, the ones that waited longest first.
+int futex_wake(u32* uaddr, int nr, u32 bitset);
+// wake up to nr_wake waiters on uaddr and move up to nr_requeue of the
+// rest to uaddr2. If cmpval is not NULL, do nothing and return -EAGAIN
+// unless *uaddr == *cmpval.
+int futex_requeue(u32* uaddr, int nr_wake, int nr_requeue, u32* uaddr2,
+                  const u32* cmpval);
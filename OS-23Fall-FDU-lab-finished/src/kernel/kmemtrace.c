@@ -0,0 +1,195 @@
+#include <kernel/kmemtrace.h>
+
+#ifdef KMEM_TRACE
+
+#include <aarch64/intrinsic.h>
+#include <common/spinlock.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/syscall.h>
+
+// Live allocations are kept in an open addressing hash table keyed by the
+// pointer. The table is split into stripes with one lock each, and a
+// pointer always probes inside its own stripe, so CPUs allocating at the
+// same time rarely contend. Deletion shifts entries back instead of
+// leaving tombstones.
+#define TRACE_STRIPES 64
+#define TRACE_SLOTS 1024            // per stripe
+#define TRACE_SITES 256             // distinct call sites in a dump
+#define TRACE_CLASSES 32            // distinct allocation sizes in a dump
+
+struct trace_entry {
+    void* ptr;                      // NULL if the slot is empty
+    void* site;
+    u64 seq;
+    u32 size;
+    u32 alloc;
+    u16 cpu;
+};
+
+static struct trace_stripe {
+    SpinLock lock;
+    u32 used;
+    struct trace_entry slot[TRACE_SLOTS];
+} __attribute__((aligned(64))) stripes[TRACE_STRIPES];
+
+static u64 seq;                     // allocations recorded so far
+static u64 dropped;                 // allocations not recorded, stripe full
+
+static INLINE u64 hash(void* p)
+{
+    return ((u64)p >> 3) * 0x9e3779b97f4a7c15ull;
+}
+
+static INLINE struct trace_stripe* stripe_of(u64 h)
+{
+    return &stripes[h >> 58];
+}
+
+void kmem_trace_alloc(void* p, usize size, usize alloc, void* site)
+{
+    if (p == NULL)
+        return;
+    u64 h = hash(p);
+    struct trace_stripe* s = stripe_of(h);
+    u32 i = h & (TRACE_SLOTS - 1);
+    _acquire_spinlock(&s->lock);
+    while (s->slot[i].ptr != NULL && s->slot[i].ptr != p)
+        i = (i + 1) & (TRACE_SLOTS - 1);
+    struct trace_entry* e = &s->slot[i];
+    if (e->ptr == NULL) {
+        // keep one slot free so that probing always terminates.
+        if (s->used == TRACE_SLOTS - 1) {
+            _release_spinlock(&s->lock);
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        s->used++;
+        e->ptr = p;
+        e->seq = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+    }
+    e->site = site;
+    e->size = (u32)size;
+    e->alloc = (u32)alloc;
+    e->cpu = (u16)cpuid();
+    _release_spinlock(&s->lock);
+}
+
+void kmem_trace_free(void* p)
+{
+    if (p == NULL)
+        return;
+    u64 h = hash(p);
+    struct trace_stripe* s = stripe_of(h);
+    u32 i = h & (TRACE_SLOTS - 1);
+    _acquire_spinlock(&s->lock);
+    while (s->slot[i].ptr != NULL && s->slot[i].ptr != p)
+        i = (i + 1) & (TRACE_SLOTS - 1);
+    if (s->slot[i].ptr == NULL) {
+        // the outer allocator of a nested allocation already removed it.
+        _release_spinlock(&s->lock);
+        return;
+    }
+    // shift later entries of the same probe run back into the hole.
+    u32 hole = i;
+    for (u32 j = (i + 1) & (TRACE_SLOTS - 1); s->slot[j].ptr != NULL;
+         j = (j + 1) & (TRACE_SLOTS - 1)) {
+        u32 home = hash(s->slot[j].ptr) & (TRACE_SLOTS - 1);
+        // move j into the hole unless its home lies in (hole, j].
+        if (((j - home) & (TRACE_SLOTS - 1)) >= ((j - hole) & (TRACE_SLOTS - 1))) {
+            s->slot[hole] = s->slot[j];
+            hole = j;
+        }
+    }
+    s->slot[hole].ptr = NULL;
+    s->used--;
+    _release_spinlock(&s->lock);
+}
+
+u64 kmem_trace_mark()
+{
+    return __atomic_load_n(&seq, __ATOMIC_RELAXED);
+}
+
+struct trace_sum {
+    u64 key;                        // call site or allocation size
+    u64 count;
+    u64 size;
+    u64 alloc;
+};
+
+static SpinLock dump_lock;
+static struct trace_sum sites[TRACE_SITES], classes[TRACE_CLASSES];
+
+static void add_sum(struct trace_sum* sum, int n, u64 key, struct trace_entry* e)
+{
+    for (int i = 0; i < n; i++) {
+        if (sum[i].count == 0)
+            sum[i].key = key;
+        if (sum[i].key == key) {
+            sum[i].count++;
+            sum[i].size += e->size;
+            sum[i].alloc += e->alloc;
+            return;
+        }
+    }
+    // out of slots, lump the rest together.
+    sum[n - 1].count++;
+    sum[n - 1].size += e->size;
+    sum[n - 1].alloc += e->alloc;
+}
+
+u64 kmem_trace_dump(u64 since)
+{
+    u64 total = 0;
+    _acquire_spinlock(&dump_lock);
+    for (int i = 0; i < TRACE_SITES; i++)
+        sites[i].count = sites[i].size = sites[i].alloc = 0;
+    for (int i = 0; i < TRACE_CLASSES; i++)
+        classes[i].count = classes[i].size = classes[i].alloc = 0;
+    for (int i = 0; i < TRACE_STRIPES; i++) {
+        struct trace_stripe* s = &stripes[i];
+        _acquire_spinlock(&s->lock);
+        for (int j = 0; j < TRACE_SLOTS; j++) {
+            struct trace_entry* e = &s->slot[j];
+            if (e->ptr == NULL || e->seq < since)
+                continue;
+            add_sum(sites, TRACE_SITES, (u64)e->site, e);
+            add_sum(classes, TRACE_CLASSES, e->alloc, e);
+            total++;
+        }
+        _release_spinlock(&s->lock);
+    }
+
+    // largest sites first.
+    for (int i = 1; i < TRACE_SITES && sites[i].count; i++) {
+        struct trace_sum t = sites[i];
+        int j = i;
+        for (; j > 0 && sites[j - 1].alloc < t.alloc; j--)
+            sites[j] = sites[j - 1];
+        sites[j] = t;
+    }
+    printk("kmem_trace: %llu live allocations since %llu, %llu not recorded\n",
+           total, since, __atomic_load_n(&dropped, __ATOMIC_RELAXED));
+    for (int i = 0; i < TRACE_SITES && sites[i].count; i++)
+        printk("  site %p: %llu allocations, %llu bytes (%llu reserved)\n",
+               (void*)sites[i].key, sites[i].count, sites[i].size, sites[i].alloc);
+    for (int i = 0; i < TRACE_CLASSES && classes[i].count; i++)
+        printk("  class %llu: %llu objects, %llu of %llu bytes used, %llu%% wasted\n",
+               classes[i].key, classes[i].count, classes[i].size, classes[i].alloc,
+               (classes[i].alloc - classes[i].size) * 100 / classes[i].alloc);
+    _release_spinlock(&dump_lock);
+    kmem_cache_dump();
+    return total;
+}
+
+// kmemtrace(since): dump what is still live from sequence number `since` on.
+// kmemtrace(-1) only returns the current sequence number as a mark.
+define_syscall(kmemtrace, u64 since)
+{
+    if (since == (u64)-1)
+        return kmem_trace_mark();
+    return kmem_trace_dump(since);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common/defines.h>
+
+// Allocation-site tracing, enabled with `cmake -DKMEM_TRACE=ON`.
+//
+// Every live allocation handed out by kalloc, kalloc_page(s) and
+// kmem_cache_alloc is recorded with its caller, size and CPU. Nested
+// allocators record the same pointer again, and the outermost call wins,
+// so kalloc(24) shows up with the caller of kalloc, not with kalloc itself.
+
+#ifdef KMEM_TRACE
+
+// `size` is what the caller asked for, `alloc` what it actually occupies.
+void kmem_trace_alloc(void *p, usize size, usize alloc, void *site);
+void kmem_trace_free(void *p);
+
+// current allocation sequence number, pass it to kmem_trace_dump later to
+// only see what has been allocated (and not freed) since.
+u64 kmem_trace_mark();
+
+// print live allocations with sequence number >= since, aggregated by call
+// site and by size class. Returns the number of such allocations.
+u64 kmem_trace_dump(u64 since);
+
+#define KMEM_TRACE_ALLOC(p, size, alloc)                                       \
+    kmem_trace_alloc(p, size, alloc, __builtin_return_address(0))
+#define KMEM_TRACE_FREE(p) kmem_trace_free(p)
+
+#else
+
+#define KMEM_TRACE_ALLOC(p, size, alloc)
+#define KMEM_TRACE_FREE(p)
+
+#endif
@@ -7,7 +7,9 @@
 #include <common/rc.h>
 #include <common/spinlock.h>
 #include <driver/memlayout.h>
+#include <kernel/cpu.h>
 #include <kernel/init.h>
+#include <kernel/kmemtrace.h>
 #include <kernel/mem.h>
 #include <driver/memlayout.h>
 #include <aarch64/mmu.h>
@@ -24,23 +26,41 @@
             ;                                                                  \
     }
 
-static struct Block {
-    struct Block *next;             // free list
-}memory_table[13];
+RefCount alloc_page_cnt;            // how many pages are allocated
+static SpinLock page_lock;          // spinlock on the buddy free lists
 
-typedef struct Block Block;
-typedef struct PageHeader {
-    u64 blocksize;                 // 16 bit aligned
-}PageHeader;
+extern char end[];
 
+// Binary buddy allocator over the `page_refs` range.
+// A free block of order k is 2^k pages aligned to 2^k pages; its first page
+// holds the ListNode on free_area[k] and page_refs[] of that page records
+// the order. On free, a block is merged with its buddy (pfn ^ (1 << k))
+// as long as the buddy is a free block of the same order.
+//
+// Memory that has never been allocated is not on the free lists. It is the
+// range [bump_pfn, end_pfn) and is handed out by bumping bump_pfn, so boot
+// does not have to touch any free page; a page joins the free lists the
+// first time it is freed.
+static struct free_area {
+    ListNode list;
+    u64 nr_free;
+} free_area[MAX_ORDER + 1];
+static u64 start_pfn, end_pfn;      // usable page frames: [start_pfn, end_pfn)
+static u64 bump_pfn;                // first never allocated page frame
 
-RefCount alloc_page_cnt;            // how many pages are allocated
-static SpinLock mem_lock;           // spinlock on memory_table
-static SpinLock page_lock;          // spinlock on page granlarity
+// Per-CPU magazine of order-0 pages in front of the buddy allocator.
+// kalloc_page/kfree_page only touch the local magazine. It is refilled from
+// and drained to the free lists PAGE_CACHE_BATCH pages at a time, so
+// `page_lock` is taken once per batch instead of once per page.
+// The kernel is not preemptible, so the magazine of cpuid() needs no lock.
+#define PAGE_CACHE_SIZE 64
+#define PAGE_CACHE_BATCH 32
 
-// All usable pages are added to the queue.
-static QueueNode* pages;            // fix-lengthed meta-data of the allocator are stored in .bss
-extern char end[];
+static struct page_cache {
+    int cnt;
+    void* pages[PAGE_CACHE_SIZE];
+    struct page_cache_stat stat;
+} __attribute__((aligned(64))) page_cache[NCPU];
 
 struct page page_refs[(PAGE_BASE(PHYSTOP) + PAGE_SIZE)/PAGE_SIZE];
 // init used page to 0
@@ -48,27 +68,255 @@ define_early_init(alloc_page_cnt){
     init_rc(&alloc_page_cnt);
 }
 
-// init locks and clear pages
-define_early_init(pages){
-    for (u64 p = PAGE_BASE((u64)&end) + PAGE_SIZE; p < P2K(PHYSTOP); p += PAGE_SIZE) add_to_queue(&pages, (QueueNode*)p); 
-    for (u64 i = 0; i <= 12; i++){
-        memory_table[i].next = NULL;
+static INLINE u64 pfn_of(void* p){
+    return K2P(p) / PAGE_SIZE;
+}
+
+static INLINE void* page_of(u64 pfn){
+    return (void*)P2K(pfn * PAGE_SIZE);
+}
+
+// caller holds page_lock.
+static void buddy_add(u64 pfn, int order){
+    page_refs[pfn].order = order;
+    page_refs[pfn].free = true;
+    _insert_into_list(&free_area[order].list, (ListNode*)page_of(pfn));
+    free_area[order].nr_free++;
+}
+
+// caller holds page_lock.
+static void buddy_del(u64 pfn, int order){
+    page_refs[pfn].free = false;
+    _detach_from_list((ListNode*)page_of(pfn));
+    free_area[order].nr_free--;
+}
+
+static void buddy_free(void* p, int order);
+
+// give [from, to) to the free lists in the largest naturally aligned blocks.
+// caller holds page_lock.
+static void free_range(u64 from, u64 to){
+    while (from < to){
+        int order = MAX_ORDER;
+        while ((from & ((1ull << order) - 1)) || from + (1ull << order) > to)
+            order--;
+        buddy_free(page_of(from), order);
+        from += 1ull << order;
+    }
+}
+
+// take a block from the never allocated range. caller holds page_lock.
+static void* bump_alloc(int order){
+    u64 pfn = round_up(bump_pfn, 1ull << order);
+    if (pfn + (1ull << order) > end_pfn)
+        return NULL;
+    // the pages skipped for alignment are free from now on
+    free_range(bump_pfn, pfn);
+    bump_pfn = pfn + (1ull << order);
+    return page_of(pfn);
+}
+
+// caller holds page_lock.
+static void* buddy_alloc(int order){
+    int k = order;
+    while (k <= MAX_ORDER && _empty_list(&free_area[k].list))
+        k++;
+    if (k > MAX_ORDER){
+        void* p = bump_alloc(order);
+        if (p != NULL)
+            page_refs[pfn_of(p)].order = order;
+        return p;
+    }
+    u64 pfn = pfn_of(free_area[k].list.next);
+    buddy_del(pfn, k);
+    // split, keep the lower half and put the upper halves back.
+    while (k > order){
+        k--;
+        buddy_add(pfn + (1ull << k), k);
+    }
+    page_refs[pfn].order = order;
+    return page_of(pfn);
+}
+
+// caller holds page_lock.
+static void buddy_free(void* p, int order){
+    u64 pfn = pfn_of(p);
+    while (order < MAX_ORDER){
+        u64 buddy = pfn ^ (1ull << order);
+        if (buddy < start_pfn || buddy + (1ull << order) > end_pfn)
+            break;
+        if (!page_refs[buddy].free || page_refs[buddy].order != order)
+            break;
+        buddy_del(buddy, order);
+        pfn &= ~(1ull << order);
+        order++;
     }
-    init_spinlock(&mem_lock);
+    buddy_add(pfn, order);
+}
+
+// init locks, all usable pages start in the never allocated range
+define_early_init(pages){
     init_spinlock(&page_lock);
+    lockstat_register(&page_lock, "page_lock");
+    for (int i = 0; i <= MAX_ORDER; i++){
+        init_list_node(&free_area[i].list);
+        free_area[i].nr_free = 0;
+    }
+    start_pfn = pfn_of((void*)(PAGE_BASE((u64)&end) + PAGE_SIZE));
+    end_pfn = pfn_of((void*)P2K(PHYSTOP));
+    bump_pfn = start_pfn;
+}
+
+// move up to PAGE_CACHE_BATCH pages from the buddy allocator to the magazine.
+static void page_cache_refill(struct page_cache* pc){
+    _acquire_spinlock(&page_lock);
+    while (pc->cnt < PAGE_CACHE_BATCH){
+        void* p = buddy_alloc(0);
+        if (!p) break;
+        pc->pages[pc->cnt++] = p;
+    }
+    _release_spinlock(&page_lock);
+    pc->stat.refill++;
+}
+
+// give the older half of a full magazine back to the buddy allocator.
+static void page_cache_drain(struct page_cache* pc){
+    _acquire_spinlock(&page_lock);
+    for (int i = 0; i < PAGE_CACHE_BATCH; i++)
+        buddy_free(pc->pages[i], 0);
+    _release_spinlock(&page_lock);
+    pc->cnt -= PAGE_CACHE_BATCH;
+    for (int i = 0; i < pc->cnt; i++)
+        pc->pages[i] = pc->pages[i + PAGE_CACHE_BATCH];
+    pc->stat.drain++;
+}
+
+static void* page_cache_get(){
+    struct page_cache* pc = &page_cache[cpuid()];
+    if (pc->cnt == 0){
+        page_cache_refill(pc);
+        if (pc->cnt == 0) return NULL;
+    }else{
+        pc->stat.hit++;
+    }
+    return pc->pages[--pc->cnt];
+}
+
+static void page_cache_put(void* p){
+    struct page_cache* pc = &page_cache[cpuid()];
+    if (pc->cnt == PAGE_CACHE_SIZE)
+        page_cache_drain(pc);
+    pc->pages[pc->cnt++] = p;
+}
+
+// Per-CPU pool of pages that are already zero.
+// idle_entry fills the local pool one page at a time, so kalloc_page() can
+// usually skip clear_page(). Pages in the pool are free pages as far as
+// alloc_page_cnt is concerned.
+#define ZERO_POOL_SIZE 32
+
+static struct zero_pool {
+    int cnt;
+    void* pages[ZERO_POOL_SIZE];
+} __attribute__((aligned(64))) zero_pool[NCPU];
+
+bool fill_zero_pool(){
+    struct zero_pool* zp = &zero_pool[cpuid()];
+    if (zp->cnt == ZERO_POOL_SIZE)
+        return false;
+    void* p = page_cache_get();
+    if (p == NULL)
+        return false;
+    clear_page(p);
+    zp->pages[zp->cnt++] = p;
+    return true;
+}
+
+static void* zero_pool_get(){
+    struct zero_pool* zp = &zero_pool[cpuid()];
+    if (zp->cnt == 0)
+        return NULL;
+    page_cache[cpuid()].stat.prezeroed++;
+    return zp->pages[--zp->cnt];
+}
+
+void get_page_cache_stat(int cpu, struct page_cache_stat* stat){
+    *stat = page_cache[cpu].stat;
+}
+
+u64 get_buddy_stat(u64 nr_free[MAX_ORDER + 1]){
+    _acquire_spinlock(&page_lock);
+    for (int i = 0; i <= MAX_ORDER; i++)
+        nr_free[i] = free_area[i].nr_free;
+    u64 untouched = end_pfn - bump_pfn;
+    _release_spinlock(&page_lock);
+    return untouched;
 }
 
 // alloc pages
 void* kalloc_page(){
-    _acquire_spinlock(&page_lock);
+    void* new_page = zero_pool_get();
+    if (new_page == NULL){
+        new_page = page_cache_get();
+        if (new_page == NULL) return NULL;
+        clear_page(new_page);
+    }
     _increment_rc(&alloc_page_cnt);
-    QueueNode* new_page = fetch_from_queue(&pages);
-    memset(new_page, 0, PAGE_SIZE);
     page_refs[K2P(new_page)/PAGE_SIZE].ref.count = 1;
-    _release_spinlock(&page_lock);
+    KMEM_TRACE_ALLOC(new_page, PAGE_SIZE, PAGE_SIZE);
     return new_page;
 }
 
+// for callers that overwrite the whole page anyway.
+void* kalloc_page_nozero(){
+    void* new_page = page_cache_get();
+    if (new_page == NULL){
+        // keep the zeroed pages as a last resort
+        new_page = zero_pool_get();
+        if (new_page == NULL) return NULL;
+    }
+    _increment_rc(&alloc_page_cnt);
+    page_refs[K2P(new_page)/PAGE_SIZE].ref.count = 1;
+    KMEM_TRACE_ALLOC(new_page, PAGE_SIZE, PAGE_SIZE);
+    return new_page;
+}
+
+void* kalloc_pages(int order){
+    ASSERT(order >= 0 && order <= MAX_ORDER);
+    if (order == 0){
+        void* p = kalloc_page();
+        KMEM_TRACE_ALLOC(p, PAGE_SIZE, PAGE_SIZE);
+        return p;
+    }
+    _acquire_spinlock(&page_lock);
+    void* p = buddy_alloc(order);
+    _release_spinlock(&page_lock);
+    if (p == NULL) return NULL;
+    __atomic_fetch_add(&alloc_page_cnt.count, 1 << order, __ATOMIC_RELAXED);
+    for (int i = 0; i < 1 << order; i++)
+        clear_page(p + i * PAGE_SIZE);
+    page_refs[pfn_of(p)].ref.count = 1;
+    KMEM_TRACE_ALLOC(p, PAGE_SIZE << order, PAGE_SIZE << order);
+    return p;
+}
+
+int get_page_order(void* p){
+    return page_refs[pfn_of(p)].order;
+}
+
+void kfree_pages(void* p, int order){
+    if (order == 0){
+        kfree_page(p);
+        return;
+    }
+    ASSERT(page_refs[pfn_of(p)].order == order);
+    KMEM_TRACE_FREE(p);
+    __atomic_fetch_sub(&alloc_page_cnt.count, 1 << order, __ATOMIC_RELAXED);
+    _acquire_spinlock(&page_lock);
+    buddy_free(p, order);
+    _release_spinlock(&page_lock);
+}
+
 u64 left_page_cnt() { return PAGE_COUNT - alloc_page_cnt.count; }
 bool zero_page_alloced = false;
 void* zero_page;
@@ -83,89 +331,13 @@ WARN_RESULT void *get_zero_page() {
 
 // free page
 void ref_page(void* p){
-     _acquire_spinlock(&page_lock);
     _increment_rc(&page_refs[K2P(p)/PAGE_SIZE].ref);
-    _release_spinlock(&page_lock);
 }
 void kfree_page(void* p){
-    _acquire_spinlock(&page_lock);
-    _decrement_rc(&page_refs[K2P(p)/PAGE_SIZE].ref);
-    if(page_refs[K2P(p)/PAGE_SIZE].ref.count == 0 && p != zero_page){
+    // the reference count is atomic, only the last holder frees the page.
+    if(_decrement_rc(&page_refs[K2P(p)/PAGE_SIZE].ref) && p != zero_page){
         _decrement_rc(&alloc_page_cnt);
-    // memset(p, 0, PAGE_SIZE);
-        add_to_queue(&pages, (QueueNode*)p);
+        KMEM_TRACE_FREE(p);
+        page_cache_put(p);
     }
-    _release_spinlock(&page_lock);
-}
-
-u64 pow(u64 a, u64 b){
-    u64 ans = 1;
-    while(b > 0){
-        if(b % 2 == 1) ans = ans * a;
-        b = b / 2;
-        a = a * a;
-    }
-    return ans;
 }
-
-u64 get_lowest_pow(u64 size){
-    if(size <= 0) return 0;
-    size -= 1;
-    for(u64 i = 0;i <= 12; i++){
-        if(size == 0) return i;
-        size = size / 2;
-    }
-    return 12;
-}
-
-// Allocate: fetch a page from the queue of usable pages.
-
-// find the page of an address
-PageHeader* get_page_header(void* p){
-    return (PageHeader*)((u64)p - (u64)p % PAGE_SIZE);
-}
-
-// add to free list
-void add_memory(u64 blocksize, void* p){
-    u64 mem_key = get_lowest_pow(blocksize);
-    ((Block*)p)->next =  memory_table[mem_key].next;
-        memory_table[mem_key].next = p;
-}
-
-// get a free block from free list
-void* pop_memory(u64 blocksize){
-    u64 mem_key = get_lowest_pow(blocksize);
-    void* ret = memory_table[mem_key].next;
-    memory_table[mem_key].next = memory_table[mem_key].next->next;
-    return ret;
-}
-
-// Free: add the page to the queue of usable pages.
-
-void* kalloc(isize size_input)
-{
-    _acquire_spinlock(&mem_lock);
-    u64 size = (u64)size_input;
-    if(size < 8) size = 8;
-    u64 mem_key = get_lowest_pow(size);
-    u64 blocksize = pow(2, mem_key);
-    if(memory_table[mem_key].next == NULL){
-        PageHeader *pagestart = kalloc_page();
-        pagestart -> blocksize = blocksize;
-        for(struct Block* p = (Block*)((u64)pagestart + 64); (u64)p + blocksize <= ((u64)pagestart + PAGE_SIZE); p = (Block* )((u64)p + blocksize)){
-            add_memory(blocksize, p);
-        }
-    }
-    void* ret = pop_memory(blocksize);
-    _release_spinlock(&mem_lock);
-    return ret;
-}
-
-void kfree(void* p)
-{
-    PageHeader* pagestart = get_page_header(p);
-    u64 blocksize = pagestart->blocksize;
-    _acquire_spinlock(&mem_lock);
-    add_memory(blocksize, p);
-    _release_spinlock(&mem_lock);
-}
\ No newline at end of file
@@ -7,16 +7,50 @@
 
 #define PAGE_COUNT ((P2K(PHYSTOP) - PAGE_BASE((u64) & end)) / PAGE_SIZE - 1)
 
+#define MAX_ORDER 10    // largest buddy block: 2^MAX_ORDER pages
+
 struct page {
     RefCount ref;
+    u8 order;       // order of the block this page heads
+    bool free;      // heads a block on a buddy free list
+};
+
+// per-CPU page cache counters, see `page_cache` in mem.c.
+struct page_cache_stat {
+    u64 hit;    // allocations served by the local magazine
+    u64 refill; // batches fetched from the global free-page queue
+    u64 drain;  // batches returned to the global free-page queue
+    u64 prezeroed; // allocations served by the zeroed page pool
 };
 
 u64 left_page_cnt();
+void get_page_cache_stat(int cpu, struct page_cache_stat *stat);
+// returns the number of pages that have never been allocated.
+u64 get_buddy_stat(u64 nr_free[MAX_ORDER + 1]);
 
 WARN_RESULT void *get_zero_page();
 
 WARN_RESULT void *kalloc_page();
+// the content of the page is undefined.
+WARN_RESULT void *kalloc_page_nozero();
+// zero one page into the local pool, returns false if there is nothing to do.
+bool fill_zero_pool();
 void kfree_page(void *);
+void ref_page(void *);
+
+// physically contiguous blocks of 2^order pages from the buddy allocator.
+WARN_RESULT void *kalloc_pages(int order);
+void kfree_pages(void *, int order);
+int get_page_order(void *);
+
+// object caches, see slab.c. `ctor` (optional) runs once per object when
+// its slab is created; objects should be returned in constructed state.
+struct kmem_cache;
+WARN_RESULT struct kmem_cache *kmem_cache_create(const char *name, usize size, usize align,
+                                                 void (*ctor)(void *));
+WARN_RESULT void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+void kmem_cache_dump();
 
 WARN_RESULT void *kalloc(isize);
-void kfree(void *);
\ No newline at end of file
+void kfree(void *);
@@ -96,6 +96,23 @@ u64 sbrk(i64 size) {
     return -1;
 }
 
+static struct section *find_section(struct pgdir *pd, u64 addr, u64 *flags) {
+    struct section *found = NULL;
+    _acquire_spinlock(&(pd->lock));
+    ListNode *node = pd->section_head.next;
+    while (node != &(pd->section_head)) {
+        struct section *sec = container_of(node, struct section, stnode);
+        if (addr >= sec->begin && addr < sec->end) {
+            found = sec;
+            *flags = sec->flags;
+            break;
+        }
+        node = node->next;
+    }
+    _release_spinlock(&(pd->lock));
+    return found;
+}
+
 int pgfault_handler(u64 iss) {
     struct proc *p = thisproc();
     struct pgdir *pd = &p->pgdir;
@@ -108,19 +125,8 @@ int pgfault_handler(u64 iss) {
     // 3. Handle the page fault accordingly
     // 4. Return to user code or kill the process
     
-    struct section *fault_section = NULL;
-    _acquire_spinlock(&(pd->lock));
-    ListNode *node = pd->section_head.next;
-    while (node != &(pd->section_head)) {
-        struct section *sec = container_of(node, struct section, stnode);
-        if (addr >= sec->begin && addr < sec->end) {
-            fault_section = sec;
-            break;
-            // find the wrong seg;
-        }
-        node = node->next;
-    }
-    _release_spinlock(&(pd->lock));
+    u64 flags = 0;
+    struct section *fault_section = find_section(pd, addr, &flags);
     // seg fault
     if(!fault_section){
         // struct section *heap = container_of(pd->section_head.next, struct section, stnode);
@@ -129,20 +135,22 @@ int pgfault_handler(u64 iss) {
         return -1;
     }
     //check
-    if(fault_section->flags & ST_HEAP){
+    if(flags & ST_HEAP){
         // new page 
         // printk("enter lazy allocation\n");
         u64 pageBoundary = PAGE_BASE(addr);
-        void* mem = kalloc_page();
+        PTEntriesPtr pte = get_pte(pd, addr, 1);
+        bool cow = PTE_FLAGS(*pte) & PTE_RO && (iss&0x2);
+        // a COW copy overwrites the whole page, no need to zero it
+        void* mem = cow ? kalloc_page_nozero() : kalloc_page();
         if (mem == 0) {
             PANIC();
             return -1;
         }
-        PTEntriesPtr pte = get_pte(pd, addr, 1);
-        if(PTE_FLAGS(*pte) & PTE_RO && (iss&0x2)){
+        if(cow){
             // copy on write
-            void* original_page = (void*)P2K(PTE_ADDRESS(*get_pte(pd, addr, 1)));
-            memcpy(mem, original_page, PAGE_SIZE);
+            void* original_page = (void*)P2K(PTE_ADDRESS(*pte));
+            copy_page(mem, original_page);
             kfree_page(original_page);
         }
         // lazy allocation
@@ -163,4 +171,23 @@ int pgfault_handler(u64 iss) {
     arch_tlbi_vmalle1is();
     return 0; // Success
     
-}
\ No newline at end of file
+}
+
+// map the page of addr now, as a fault on it would, for kernel code that
+// needs its physical address. -1 if addr is in no heap section.
+int fault_in_page(u64 addr) {
+    struct pgdir *pd = &thisproc()->pgdir;
+    u64 flags = 0;
+    if (find_section(pd, addr, &flags) == NULL || !(flags & ST_HEAP))
+        return -1;
+    PTEntriesPtr pte = get_pte(pd, addr, false);
+    if (pte && (*pte & PTE_VALID))
+        return 0;
+    void *mem = kalloc_page();
+    if (mem == NULL)
+        return -1;
+    vmmap(pd, PAGE_BASE(addr), mem, PTE_USER_DATA);
+    kfree_page(mem);
+    arch_tlbi_vmalle1is();
+    return 0;
+}
@@ -23,6 +23,7 @@ struct section {
 };
 
 int pgfault_handler(u64 iss);
+int fault_in_page(u64 addr);
 void init_sections(ListNode *section_head);
 void free_sections(struct pgdir *pd);
 void copy_sections(ListNode *from_head, ListNode *to_head);
@@ -3,19 +3,22 @@
 #include <kernel/mem.h>
 #include <kernel/sched.h>
 #include <common/list.h>
+#include <common/rcu.h>
+#include <common/rwlock.h>
 #include <common/string.h>
 #include <kernel/printk.h>
 
 
 struct proc root_proc;
-static SpinLock treelock;
+static RWLock treelock;
 
 void kernel_entry();
 void proc_entry();
 
 define_early_init(proc_tree)
 {
-    init_spinlock(&treelock);
+    init_rwlock(&treelock);
+    lockstat_register_rwlock(&treelock, "treelock");
     
 }
 
@@ -30,6 +33,10 @@ struct PidMap {
 
 static struct PidMap pid_alloc;
 
+// every process that has a pid, by pid. Written under treelock, read
+// without a lock by find_proc(). A process is freed with call_rcu().
+static struct proc* pid_table[MAX_PID];
+
 define_early_init(pidalloc){
     pid_alloc.last_pid = -1;
     for (int i = 0; i < BITMAP_SIZE; ++i) {
@@ -78,10 +85,10 @@ void set_parent_to_this(struct proc* proc)
     // TODO: set the parent of proc to thisproc
     // NOTE: maybe you need to lock the process tree
     // NOTE: it's ensured that the old proc->parent = NULL
-    _acquire_spinlock(&treelock);
+    _acquire_write_lock(&treelock);
     proc->parent = thisproc();
     _insert_into_list(&thisproc()->children, &proc->ptnode);
-    _release_spinlock(&treelock);
+    _release_write_lock(&treelock);
 
 }
 
@@ -94,10 +101,10 @@ NO_RETURN void exit(int code)
     // 4. notify the parent
     // 5. sched(ZOMBIE)
     // NOTE: be careful of concurrency
-    _acquire_spinlock(&treelock);
+    _acquire_write_lock(&treelock);
     struct proc* this = thisproc();
     this->exitcode = code;
-    kfree_page(this->kstack);
+    // the kernel stack is still in use, wait() frees it
     free_pgdir(&this->pgdir);    
     if(!_empty_list(&thisproc()->children)){
         _for_in_list(p, &thisproc()->children){
@@ -112,12 +119,21 @@ NO_RETURN void exit(int code)
         if(children) _merge_list(&root_proc.children, children);
     }
     post_sem(&thisproc()->parent->childexit);
-    _release_spinlock(&treelock);
+    _release_write_lock(&treelock);
     _acquire_sched_lock();
     _sched(ZOMBIE);
     PANIC(); // prevent the warning of 'no_return function returns'
 }
 
+// a zombie is reaped only after it has switched away, and the grace
+// period passes another switch on its cpu, so the stack is unused now.
+static void free_proc(struct rcu_head* head)
+{
+    struct proc* p = container_of(head, struct proc, rcu);
+    kfree_pages(p->kstack, KSTACK_ORDER);
+    kfree(p);
+}
+
 int wait(int* exitcode)
 {
     // TODO
@@ -126,16 +142,16 @@ int wait(int* exitcode)
     // 3. if any child exits, clean it up and return its pid and exitcode
     // NOTE: be careful of concurrency
     // if(thisproc()->pid == 0) printk("this pid, id = %d\n", thisproc()->pid);
-    _acquire_spinlock(&treelock);
+    _acquire_read_lock(&treelock);
     auto this = thisproc();
     if(_empty_list(&this->children)) {
-        _release_spinlock(&treelock);
+        _release_read_lock(&treelock);
         return -1;
     }
-    _release_spinlock(&treelock);
+    _release_read_lock(&treelock);
     bool ret = wait_sem(&this->childexit);
     if(!ret) printk("signal interrupted\n");
-    _acquire_spinlock(&treelock);
+    _acquire_write_lock(&treelock);
     _for_in_list(p, &thisproc()->children){
         if(p == &thisproc()->children) continue;
         struct proc* candidate = container_of(p, struct proc, ptnode);
@@ -143,49 +159,50 @@ int wait(int* exitcode)
             *exitcode = candidate->exitcode;
             int id = candidate->pid;
             _detach_from_list(&candidate->ptnode);
+            pid_table[candidate->pid] = NULL;
             release_pid(candidate->pid);
-            kfree(candidate);
-            _release_spinlock(&treelock);
+            call_rcu(&candidate->rcu, free_proc);
+            _release_write_lock(&treelock);
             return id;
         }
     }
-     _release_spinlock(&treelock);
+     _release_write_lock(&treelock);
      PANIC();
     return -1;
 }
 
-struct proc* dfs_tree(struct proc* fa, int pid){
-    // printk("dfs search pid = %d, this = %d\n", pid, fa->pid);
-    _for_in_list(p, &fa->children){
-        if(p == &fa->children) continue;
-        struct proc* child = container_of(p, struct proc, ptnode);
-        
-        if(child->pid == pid && child->state != UNUSED){
-            child->killed = 1;
-            _release_spinlock(&treelock);
-            alert_proc(child);
-            return child;
-        }
-        struct proc* res = dfs_tree(child,pid);
-        if (res != NULL) return res;
-        
+// find a started process other than root_proc by pid, without a lock.
+// On success we stay in an RCU read section, so the process cannot be
+// freed until put_proc(). Do not sleep before that.
+struct proc* find_proc(int pid)
+{
+    if(!check_pid(pid)) return NULL;
+    rcu_read_lock();
+    struct proc* p = rcu_dereference(pid_table[pid]);
+    if(p == NULL || p == &root_proc || p->state == UNUSED){
+        rcu_read_unlock();
+        return NULL;
     }
-    return NULL;
-};
+    return p;
+}
+
+void put_proc(struct proc* p)
+{
+    (void)p;
+    rcu_read_unlock();
+}
 
 int kill(int pid)
 {
-    _acquire_spinlock(&treelock);
     if(!check_pid(pid)){
         printk("invalid pid\n");
-        _release_spinlock(&treelock);
-        return -1;
-    }
-    if(!dfs_tree(&root_proc, pid)) {
-        _release_spinlock(&treelock);
         return -1;
     }
-    _release_spinlock(&treelock);
+    struct proc* p = find_proc(pid);
+    if(p == NULL) return -1;
+    p->killed = 1;
+    alert_proc(p);
+    put_proc(p);
     return 0;
     // TODO
     // Set the killed flag of the proc to true and return 0.
@@ -200,12 +217,12 @@ int start_proc(struct proc* p, void(*entry)(u64), u64 arg)
     // 2. setup the kcontext to make the proc start with proc_entry(entry, arg)
     // 3. activate the proc and return its pid
     // NOTE: be careful of concurrency
-    _acquire_spinlock(&treelock);
+    _acquire_write_lock(&treelock);
     if(p->parent == NULL){
         p->parent = &root_proc;
         _insert_into_list(&root_proc.children, &p->ptnode);
     }
-    _release_spinlock(&treelock);
+    _release_write_lock(&treelock);
     p->kcontext->lr = (u64)&proc_entry;
     p->kcontext->x0 = (u64)entry;
     p->kcontext->x1 = (u64)arg;
@@ -214,27 +231,35 @@ int start_proc(struct proc* p, void(*entry)(u64), u64 arg)
     return id;
 }
 
+// start a kernel thread that only ever runs on `cpu`.
+int start_proc_pinned(struct proc* p, int cpu, void(*entry)(u64), u64 arg)
+{
+    ASSERT(set_affinity(p, 1u << cpu) == 0);
+    return start_proc(p, entry, arg);
+}
+
 void init_proc(struct proc* p)
 {
     // TODO
     // setup the struct proc with kstack and pid allocated
     // NOTE: be careful of concurrency
     memset(p, 0, sizeof(*p));
-    _acquire_spinlock(&treelock);
+    _acquire_write_lock(&treelock);
     p->killed = 0;
     p->idle = 0;
     p->state = UNUSED;
     p->pid = get_pid();
     init_sem(&p->childexit, 0);
     init_pgdir(&p->pgdir);
-    p->kstack = kalloc_page();
+    p->kstack = kalloc_pages(KSTACK_ORDER);
     init_schinfo(&p->schinfo);
     init_list_node(&p->children);
     init_list_node(&p->ptnode);
-    p->kcontext = (KernelContext*)((u64)p->kstack + PAGE_SIZE - 16 - sizeof(KernelContext) - sizeof(UserContext));
-    p->ucontext = (UserContext*)((u64)p->kstack + PAGE_SIZE - 16 - sizeof(UserContext));
+    p->kcontext = (KernelContext*)((u64)p->kstack + KSTACK_SIZE - 16 - sizeof(KernelContext) - sizeof(UserContext));
+    p->ucontext = (UserContext*)((u64)p->kstack + KSTACK_SIZE - 16 - sizeof(UserContext));
+    if(p->pid >= 0) rcu_assign_pointer(pid_table[p->pid], p);
     // printk("init proc pid = %d\n", p->pid);
-    _release_spinlock(&treelock);
+    _release_write_lock(&treelock);
 
 }
 
@@ -2,6 +2,7 @@
 
 #include <common/defines.h>
 #include <common/list.h>
+#include <common/rcu.h>
 #include <common/sem.h>
 #include <fs/file.h>
 #include <fs/inode.h>
@@ -29,6 +30,9 @@ typedef struct KernelContext
 
 } KernelContext;
 
+#define KSTACK_ORDER 1
+#define KSTACK_SIZE (PAGE_SIZE << KSTACK_ORDER)
+
 struct proc {
     bool killed;
     bool idle;
@@ -46,11 +50,15 @@ struct proc {
     KernelContext *kcontext;
     struct oftable oftable;
     Inode *cwd; // current working dictionary
+    struct rcu_head rcu; // freed after lockless lookups are done with it
 };
 
 // void init_proc(struct proc*);
 WARN_RESULT struct proc *create_proc();
 int start_proc(struct proc *, void (*entry)(u64), u64 arg);
+int start_proc_pinned(struct proc *, int cpu, void (*entry)(u64), u64 arg);
+WARN_RESULT struct proc *find_proc(int pid);
+void put_proc(struct proc *);
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
@@ -3,24 +3,101 @@
 #include <kernel/init.h>
 #include <kernel/mem.h>
 #include <kernel/printk.h>
+#include <kernel/schedtrace.h>
 #include <aarch64/intrinsic.h>
+#include <common/rcu.h>
 #include <kernel/cpu.h>
 #include <driver/clock.h>
+#include <driver/interrupt.h>
 
 #define ELAPSE 7
+#define SCHED_LATENCY 24    // every runnable process runs once in this many ms
+#define MIN_ELAPSE 2        // but no slice is shorter than this
+#define BALANCE_TICKS 4     // run the load balancer every BALANCE_TICKS slices
+#define MIGRATE_SCAN 8      // queued processes looked at for one to steal
+#define RR_ELAPSE 25        // time slice of SCHED_RR processes, in ms
 
 extern bool panic_flag;
 
 extern void swtch(KernelContext* new_ctx, KernelContext** old_ctx);
 
-static SpinLock runlock;
-static ListNode runnable_queue;
+// Every cpu has its own run queue in `struct sched`. New processes are
+// queued on the cpu that starts them and woken processes on the cpu they
+// last ran on. An idle cpu steals from the busiest queue, and every
+// BALANCE_TICKS slices a cpu pulls work from a queue that is two or more
+// processes longer than its own.
+//
+// A run queue is a red-black tree ordered by vruntime, the time a process
+// has run as measured by get_timestamp() at each switch. The leftmost
+// process has had the least cpu and runs next. A process that slept or
+// moved to another queue is not allowed to stay far behind the others: its
+// vruntime is raised to the min_vruntime of the queue it joins.
+//
+// The nice value of a process selects a weight. vruntime advances by
+// NICE_0_WEIGHT / weight of the real time run, so the cpu is shared in
+// proportion to weight. Each step of nice is about 1.25x, as in Linux.
+//
+// The time slice is the share of SCHED_LATENCY given by the weight of the
+// process over the weight of everything runnable on the cpu. A process that
+// is alone on its cpu runs with no preemption timer at all, and neither
+// does idle, so a cpu with nothing to do takes interrupts only for real
+// timers and devices. Such a cpu would not notice a process queued on it by
+// another cpu, so the waking cpu kicks it with an IPI.
+//
+// Idle cpus are kept in idle_mask. A woken process goes back to the cpu it
+// last ran on if that cpu is idle or no cpu is, and to an idle cpu
+// otherwise. A cpu without a tick never runs the balancer, so a busy cpu
+// also pushes: every BALANCE_TICKS slices it moves one waiting process to
+// the least loaded cpu, idle or not, if that has two processes less.
+//
+// A process is only ever queued on a cpu in its affinity mask. When the
+// mask of a running process excludes its cpu, the process is moved at its
+// next switch: it is left off the queue and whoever runs next on the cpu
+// queues it elsewhere once its context is saved, see finish_switch().
+//
+// SCHED_FIFO and SCHED_RR processes are kept apart from the tree, in one
+// list per priority with a bitmap of the non-empty lists, and always run
+// before SCHED_NORMAL ones. FIFO runs until it blocks or yields, RR also
+// goes to the tail of its list every RR_ELAPSE ms. A woken real-time
+// process goes to the allowed cpu with the least important work, running
+// or queued, as long as that is below its own priority. When a wakeup
+// queues a process of higher priority than the one running, the running
+// process is preempted: at once through an IPI on another cpu, at the end
+// of the current trap on this one. A preempted real-time process stays at
+// the head of its list.
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+static volatile u32 idle_mask;
+
+static void resched_ipi();
 
 define_early_init(runnable_queue)
 {
-    init_spinlock(&runlock);
-    init_list_node(&runnable_queue);
-    
+    for (int i = 0; i < NCPU; i++) {
+        init_spinlock(&cpus[i].sched.lock);
+        lockstat_register(&cpus[i].sched.lock, "runqueue");
+        cpus[i].sched.rq.rb_node = NULL;
+        cpus[i].sched.nr_running = 0;
+        cpus[i].sched.min_vruntime = 0;
+        cpus[i].sched.load = 0;
+        cpus[i].sched.tick_stopped = true;
+        cpus[i].sched.migrate = NULL;
+        for (int j = 0; j < MAX_RT_PRIO; j++)
+            init_list_node(&cpus[i].sched.rt_queue[j]);
+        cpus[i].sched.rt_bitmap = 0;
+        cpus[i].sched.need_resched = false;
+    }
+    idle_mask = 0;
+    set_ipi_handler(resched_ipi);
 }
 define_init(idle)
 {
@@ -29,13 +106,231 @@ define_init(idle)
         p->idle = 1;
         p->state = RUNNING;
         init_schinfo(&p->schinfo);
+        p->schinfo.cpu = i;
         // p->kstack = kalloc_page();
-        p->schinfo.t->elapse = ELAPSE;
+        p->schinfo.t.elapse = ELAPSE;
         cpus[i].sched.thisproc = p;
         cpus[i].sched.idle = p;
     }
 }
 
+static INLINE struct sched* this_rq()
+{
+    return &cpus[cpuid()].sched;
+}
+
+static INLINE int rq_cpu(struct sched* rq)
+{
+    return (int)(container_of(rq, struct cpu, sched) - cpus);
+}
+
+// lock the run queue of p. p may move to another queue while we wait for
+// the lock, so check again once it is held.
+static struct sched* lock_rq(struct proc* p)
+{
+    while (1) {
+        struct sched* rq = &cpus[p->schinfo.cpu].sched;
+        _acquire_spinlock(&rq->lock);
+        if (rq == &cpus[p->schinfo.cpu].sched)
+            return rq;
+        _release_spinlock(&rq->lock);
+    }
+}
+
+// lock the run queue of p and `other`, lower cpu first.
+static struct sched* lock_rq_and(struct proc* p, struct sched* other)
+{
+    while (1) {
+        struct sched* rq = &cpus[p->schinfo.cpu].sched;
+        struct sched* first = rq < other ? rq : other;
+        struct sched* second = rq < other ? other : rq;
+        _acquire_spinlock(&first->lock);
+        if (second != first)
+            _acquire_spinlock(&second->lock);
+        if (rq == &cpus[p->schinfo.cpu].sched)
+            return rq;
+        if (second != first)
+            _release_spinlock(&second->lock);
+        _release_spinlock(&first->lock);
+    }
+}
+
+static bool __vruntime_cmp(rb_node lnode, rb_node rnode)
+{
+    i64 d = container_of(lnode, struct proc, schinfo.rq_node)->schinfo.vruntime -
+            container_of(rnode, struct proc, schinfo.rq_node)->schinfo.vruntime;
+    if (d < 0)
+        return true;
+    if (d == 0)
+        return lnode < rnode;
+    return false;
+}
+
+static INLINE bool is_rt(struct proc* p)
+{
+    return p->schinfo.policy != SCHED_NORMAL;
+}
+
+// idle < SCHED_NORMAL (0) < real-time priorities
+static INLINE int prio_of(struct proc* p)
+{
+    return p->idle ? -1 : p->schinfo.rt_priority;
+}
+
+// real-time processes go to the tail of their list
+static void enqueue(struct sched* rq, struct proc* p)
+{
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        _insert_into_list(rq->rt_queue[prio].prev, &p->schinfo.rt_node);
+        rq->rt_bitmap |= 1ull << prio;
+    } else {
+        ASSERT(0 == _rb_insert(&p->schinfo.rq_node, &rq->rq, __vruntime_cmp));
+        rq->load += p->schinfo.weight;
+    }
+    p->schinfo.queued = true;
+    rq->nr_running++;
+}
+
+static void dequeue(struct sched* rq, struct proc* p)
+{
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        _detach_from_list(&p->schinfo.rt_node);
+        if (_empty_list(&rq->rt_queue[prio]))
+            rq->rt_bitmap &= ~(1ull << prio);
+    } else {
+        _rb_erase(&p->schinfo.rq_node, &rq->rq);
+        rq->load -= p->schinfo.weight;
+    }
+    p->schinfo.queued = false;
+    rq->nr_running--;
+}
+
+// the highest priority real-time process in rq
+static INLINE struct proc* first_rt(struct sched* rq)
+{
+    if (rq->rt_bitmap == 0)
+        return NULL;
+    int prio = 63 - __builtin_clzll(rq->rt_bitmap);
+    return container_of(rq->rt_queue[prio].next, struct proc, schinfo.rt_node);
+}
+
+static INLINE bool allowed_on(struct proc* p, struct sched* rq)
+{
+    return p->schinfo.affinity & (1u << rq_cpu(rq));
+}
+
+static INLINE struct proc* first_proc(struct sched* rq)
+{
+    rb_node node = _rb_first(&rq->rq);
+    return node ? container_of(node, struct proc, schinfo.rq_node) : NULL;
+}
+
+// a process joining rq after a sleep or a migration starts at min_vruntime
+static INLINE void place_proc(struct sched* rq, struct proc* p)
+{
+    if ((i64)(p->schinfo.vruntime - rq->min_vruntime) < 0)
+        p->schinfo.vruntime = rq->min_vruntime;
+}
+
+static struct sched* find_busiest(struct sched* rq)
+{
+    struct sched* busiest = NULL;
+    int max = 0;
+    for (int i = 0; i < NCPU; i++) {
+        struct sched* other = &cpus[i].sched;
+        int n = __atomic_load_n(&other->nr_running, __ATOMIC_RELAXED);
+        if (other != rq && n > max) {
+            busiest = other;
+            max = n;
+        }
+    }
+    return busiest;
+}
+
+// a queued process of `from` that may run on `rq`: the first allowed one of
+// the highest real-time list, or else the leftmost allowed one in the tree.
+static struct proc* steal_candidate(struct sched* from, struct sched* rq)
+{
+    struct proc* p = first_rt(from);
+    if (p != NULL) {
+        ListNode* head = &from->rt_queue[p->schinfo.rt_priority];
+        for (ListNode* node = head->next; node != head; node = node->next) {
+            p = container_of(node, struct proc, schinfo.rt_node);
+            if (allowed_on(p, rq))
+                return p;
+        }
+    }
+    rb_node node = _rb_first(&from->rq);
+    for (int i = 0; node != NULL && i < MIGRATE_SCAN; i++, node = _rb_next(node)) {
+        p = container_of(node, struct proc, schinfo.rq_node);
+        if (allowed_on(p, rq))
+            return p;
+    }
+    return NULL;
+}
+
+// move a process of `from` that may run on `rq`, keeping its lag behind
+// the min_vruntime of its queue. Both locks are held.
+static struct proc* migrate_one(struct sched* from, struct sched* rq)
+{
+    struct proc* p = steal_candidate(from, rq);
+    if (p == NULL)
+        return NULL;
+    dequeue(from, p);
+    p->schinfo.vruntime = p->schinfo.vruntime - from->min_vruntime + rq->min_vruntime;
+    p->schinfo.cpu = rq_cpu(rq);
+    enqueue(rq, p);
+    return p;
+}
+
+// pull one process from the busiest queue if it is at least `imbalance`
+// longer than ours. rq->lock is held; the other lock is only tried, so two
+// cpus pulling from each other cannot deadlock.
+static bool pull_from_busiest(struct sched* rq, int imbalance)
+{
+    struct sched* busiest = find_busiest(rq);
+    if (busiest == NULL || !_try_acquire_spinlock(&busiest->lock))
+        return false;
+    bool moved = false;
+    if (busiest->nr_running - rq->nr_running >= imbalance)
+        moved = migrate_one(busiest, rq) != NULL;
+    _release_spinlock(&busiest->lock);
+    return moved;
+}
+
+// queued processes plus the running one
+static INLINE int cpu_load(int cpu)
+{
+    return __atomic_load_n(&cpus[cpu].sched.nr_running, __ATOMIC_RELAXED) +
+           !(idle_mask & (1u << cpu));
+}
+
+static void kick_rq(struct sched* rq, struct proc* p);
+
+// push one process of rq to the least loaded cpu if that has at least
+// `imbalance` processes less. rq->lock is held, the other lock is tried.
+static bool push_to_idlest(struct sched* rq, int imbalance)
+{
+    struct sched* idlest = NULL;
+    int min = cpu_load(rq_cpu(rq)) - imbalance + 1;
+    for (int i = 0; i < NCPU; i++) {
+        int n = cpu_load(i);
+        if (i != rq_cpu(rq) && n < min) {
+            idlest = &cpus[i].sched;
+            min = n;
+        }
+    }
+    if (idlest == NULL || !_try_acquire_spinlock(&idlest->lock))
+        return false;
+    struct proc* p = migrate_one(rq, idlest);
+    if (p != NULL)
+        kick_rq(idlest, p);
+    _release_spinlock(&idlest->lock);
+    return p != NULL;
+}
+
 struct proc* thisproc()
 {
     // TODO: return the current process
@@ -48,109 +343,398 @@ void interrupt(struct timer* t)
     // printk("pid %d: interrupt\n", thisproc()->pid);
     t->data++;
     _acquire_sched_lock();
+    struct sched* rq = this_rq();
+    if (++rq->ticks % BALANCE_TICKS == 0) {
+        pull_from_busiest(rq, 2);
+        if (rq->nr_running > 0)
+            push_to_idlest(rq, 2);
+    }
     _sched(RUNNABLE);
 }
 
 void init_schinfo(struct schinfo* p)
 {
     // TODO: initialize your customized schinfo for every newly-created process
-   init_list_node(&p->runnable_queue);
-   p->t = kalloc(sizeof(struct timer));
    p->cnt = 0;
-   p->t->triggered = false;
-   p->t->elapse = ELAPSE;
-   p->t->handler = interrupt;
+   p->vruntime = 0;
+   p->exec_start = 0;
+   p->nice = 0;
+   p->weight = NICE_0_WEIGHT;
+   p->cpu = cpuid();
+   p->affinity = CPU_MASK_ALL;
+   p->queued = false;
+   p->policy = SCHED_NORMAL;
+   p->rt_priority = 0;
+   init_list_node(&p->rt_node);
+   p->t.triggered = false;
+   p->t.elapse = ELAPSE;
+   p->t.handler = interrupt;
 }
 
 void _acquire_sched_lock()
 {
     // TODO: acquire the sched_lock if need
-    _acquire_spinlock(&runlock);
+    _acquire_spinlock(&this_rq()->lock);
 }
 
 void _release_sched_lock()
 {
     // TODO: release the sched_lock if need
-    _release_spinlock(&runlock);
+    _release_spinlock(&this_rq()->lock);
 
 }
 
 bool is_zombie(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    struct sched* rq = lock_rq(p);
     r = p->state == ZOMBIE;
-    _release_sched_lock();
+    _release_spinlock(&rq->lock);
     return r;
 }
 
 bool is_unused(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    struct sched* rq = lock_rq(p);
     r = p->state == UNUSED;
-    _release_sched_lock();
+    _release_spinlock(&rq->lock);
     return r;
 }
 
+void set_nice(struct proc* p, int nice)
+{
+    nice = MAX(NICE_MIN, MIN(NICE_MAX, nice));
+    struct sched* rq = lock_rq(p);
+    // vruntime so far stays as it is, only time from now on uses the new weight
+    u32 weight = nice_to_weight[nice - NICE_MIN];
+    if (p->schinfo.queued && !is_rt(p))
+        rq->load = rq->load - p->schinfo.weight + weight;
+    p->schinfo.nice = nice;
+    p->schinfo.weight = weight;
+    _release_spinlock(&rq->lock);
+}
+
+int get_nice(struct proc* p)
+{
+    return p->schinfo.nice;
+}
+
+// the most important work on a cpu, running or queued. read without the
+// lock, it is only a hint.
+static int cpu_prio(int cpu)
+{
+    struct sched* rq = &cpus[cpu].sched;
+    int prio = prio_of(rq->thisproc);
+    u64 queued = __atomic_load_n(&rq->rt_bitmap, __ATOMIC_RELAXED);
+    if (queued != 0)
+        prio = MAX(prio, 63 - __builtin_clzll(queued));
+    return prio;
+}
+
+// the allowed cpu where a real-time process preempts the least important
+// work, prev on a tie. -1 if it outranks nothing anywhere.
+static int select_rt_cpu(struct proc* p)
+{
+    int prev = p->schinfo.cpu, best = -1, best_prio = prio_of(p);
+    u32 allowed = p->schinfo.affinity;
+    if (allowed & (1u << prev)) {
+        int prio = cpu_prio(prev);
+        if (prio < best_prio) {
+            best = prev;
+            best_prio = prio;
+        }
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if (i == prev || !(allowed & (1u << i)))
+            continue;
+        int prio = cpu_prio(i);
+        if (prio < best_prio) {
+            best = i;
+            best_prio = prio;
+        }
+    }
+    return best;
+}
+
+// where a woken process should run. the answer may be stale by the time
+// the queue is locked, that only costs a worse choice.
+static struct sched* select_rq(struct proc* p)
+{
+    int prev = p->schinfo.cpu;
+    u32 allowed = p->schinfo.affinity;
+    if (is_rt(p)) {
+        int cpu = select_rt_cpu(p);
+        if (cpu >= 0)
+            return &cpus[cpu].sched;
+    }
+    u32 idle = idle_mask & allowed;
+    if ((allowed & (1u << prev)) && (idle == 0 || (idle & (1u << prev))))
+        return &cpus[prev].sched;
+    if (idle != 0)
+        return &cpus[__builtin_ctz(idle)].sched;
+    if (allowed & (1u << cpuid()))
+        return this_rq();
+    return &cpus[__builtin_ctz(allowed)].sched;
+}
+
+// whether p, running on rq, has to share the cpu in time slices
+static bool needs_slice(struct sched* rq, struct proc* p)
+{
+    if (p->idle || p->schinfo.policy == SCHED_FIFO)
+        return false;
+    if (p->schinfo.policy == SCHED_RR)
+        return !_empty_list(&rq->rt_queue[p->schinfo.rt_priority]);
+    return rq->nr_running > 0;
+}
+
+// arm the preemption timer of p, which runs on this cpu
+static void start_slice(struct sched* rq, struct proc* p)
+{
+    if (p->schinfo.policy == SCHED_RR) {
+        p->schinfo.t.elapse = RR_ELAPSE;
+    } else {
+        u64 slice = SCHED_LATENCY * p->schinfo.weight / (p->schinfo.weight + rq->load);
+        p->schinfo.t.elapse = MAX(MIN_ELAPSE, (int)slice);
+    }
+    rq->tick_stopped = false;
+    set_cpu_timer(&p->schinfo.t);
+}
+
+// make `rq` notice p, which was just queued on it. caller holds rq->lock.
+static void kick_rq(struct sched* rq, struct proc* p)
+{
+    struct proc* curr = rq->thisproc;
+    bool local = rq == this_rq();
+    if (curr->idle) {
+        // idle yields as soon as wfi returns
+        if (!local)
+            send_ipi(rq_cpu(rq));
+    } else if (prio_of(p) > prio_of(curr)) {
+        rq->need_resched = true;
+        if (!local)
+            send_ipi(rq_cpu(rq));
+    } else if (rq->tick_stopped && needs_slice(rq, curr)) {
+        // curr was alone, it has to share the cpu from now on
+        if (!local)
+            send_ipi(rq_cpu(rq));
+        else
+            start_slice(rq, curr);
+    }
+}
+
+// runs on the cpu that received the IPI, see kick_rq(). a pending
+// need_resched is handled when the trap returns.
+static void resched_ipi()
+{
+    struct sched* rq = this_rq();
+    struct proc* p = thisproc();
+    if (p->idle)
+        return;
+    _acquire_spinlock(&rq->lock);
+    if (!rq->need_resched && rq->tick_stopped && needs_slice(rq, p))
+        start_slice(rq, p);
+    _release_spinlock(&rq->lock);
+}
+
+void check_resched()
+{
+    if (this_rq()->need_resched)
+        yield();
+}
+
+// queue p, which is RUNNABLE and on no queue, on `target`. The lock of
+// target and of rq, the queue p belonged to, are held.
+static void enqueue_on(struct sched* rq, struct sched* target, struct proc* p)
+{
+    if (target != rq) {
+        p->schinfo.vruntime = p->schinfo.vruntime - rq->min_vruntime + target->min_vruntime;
+        p->schinfo.cpu = rq_cpu(target);
+    }
+    place_proc(target, p);
+    enqueue(target, p);
+    kick_rq(target, p);
+}
+
+// queue a RUNNABLE process that is on no queue somewhere it is allowed.
+static void move_proc(struct proc* p)
+{
+    struct sched* target = select_rq(p);
+    struct sched* rq = lock_rq_and(p, target);
+    if (p->state == RUNNABLE && !p->schinfo.queued)
+        enqueue_on(rq, target, p);
+    if (rq != target)
+        _release_spinlock(&target->lock);
+    _release_spinlock(&rq->lock);
+}
+
+int set_affinity(struct proc* p, u32 mask)
+{
+    mask &= CPU_MASK_ALL;
+    if (mask == 0)
+        return -1;
+    struct sched* rq = lock_rq(p);
+    p->schinfo.affinity = mask;
+    bool move = p->schinfo.queued && !allowed_on(p, rq);
+    if (move)
+        dequeue(rq, p);
+    else if (rq->thisproc == p && rq != this_rq() && !allowed_on(p, rq)) {
+        // a lone process may have no slice timer, make it switch now
+        rq->need_resched = true;
+        send_ipi(rq_cpu(rq));
+    }
+    _release_spinlock(&rq->lock);
+    if (move)
+        move_proc(p);
+    else if (p == thisproc() && !allowed_on(p, this_rq()))
+        yield();
+    return 0;
+}
+
+u32 get_affinity(struct proc* p)
+{
+    return p->schinfo.affinity;
+}
+
+int set_scheduler(struct proc* p, int policy, int prio)
+{
+    if (policy == SCHED_NORMAL) {
+        if (prio != 0)
+            return -1;
+    } else if (policy != SCHED_FIFO && policy != SCHED_RR) {
+        return -1;
+    } else if (prio < 1 || prio >= MAX_RT_PRIO) {
+        return -1;
+    }
+    struct sched* rq = lock_rq(p);
+    bool queued = p->schinfo.queued;
+    if (queued)
+        dequeue(rq, p);
+    // vruntime did not advance while p was real-time
+    if (is_rt(p) && policy == SCHED_NORMAL)
+        place_proc(rq, p);
+    p->schinfo.policy = policy;
+    p->schinfo.rt_priority = prio;
+    if (queued) {
+        enqueue(rq, p);
+        kick_rq(rq, p);
+    } else if (rq->thisproc == p) {
+        // let its cpu choose again
+        rq->need_resched = true;
+        if (rq != this_rq())
+            send_ipi(rq_cpu(rq));
+    }
+    _release_spinlock(&rq->lock);
+    return 0;
+}
+
+int get_scheduler(struct proc* p)
+{
+    return p->schinfo.policy;
+}
+
+int get_rt_priority(struct proc* p)
+{
+    return p->schinfo.rt_priority;
+}
+
+static void sleep_timer_handler(struct timer* t)
+{
+    activate_proc((struct proc*)t->data);
+}
+
+u64 sleep_ms(u64 ms)
+{
+    while (ms > 0) {
+        // elapse is an int, sleep for longer times in pieces
+        struct timer t;
+        t.elapse = (int)MIN(ms, (u64)(1 << 30));
+        t.handler = sleep_timer_handler;
+        t.data = (u64)thisproc();
+        // the timer is on this cpu, it cannot fire before we are asleep
+        _acquire_sched_lock();
+        set_cpu_timer(&t);
+        _sched(SLEEPING);
+        cancel_cpu_timer(&t);
+        if (!t.triggered) {
+            u64 now = get_timestamp_ms();
+            return ms - t.elapse + (t._key > now ? t._key - now : 0);
+        }
+        ms -= t.elapse;
+    }
+    return 0;
+}
+
 bool _activate_proc(struct proc* p, bool onalert)
 {
     // TODO
     // if the proc->state is RUNNING/RUNNABLE, do nothing
     // if the proc->state if SLEEPING/UNUSED, set the process state to RUNNABLE and add it to the sched queue
     // else: panic
-    _acquire_sched_lock();
+    struct sched* target = select_rq(p);
+    struct sched* rq = lock_rq_and(p, target);
+    bool ret = false;
     // printk("activate proc, pid = %d\n", p->pid);
     if(p->state == RUNNABLE || p->state == RUNNING){
-        _release_sched_lock();
-        return false;
-    }else if(p->state == SLEEPING || p->state == UNUSED){
+        ret = false;
+    }else if(p->state == SLEEPING || p->state == UNUSED || (p->state == DEEPSLEEPING && !onalert)){
         p->state = RUNNABLE;
-        _insert_into_list(&runnable_queue, &p->schinfo.runnable_queue);
-    }else if(p->state == DEEPSLEEPING){
-        if(onalert == true) {
-            _release_sched_lock();
-            return false;
-        }
-        else{
-            p->state = RUNNABLE;
-            _insert_into_list(&runnable_queue, &p->schinfo.runnable_queue);
-        }
-    }else{
-        _release_sched_lock();
-        return false;
+        ret = true;
+    }
+    if (ret) {
+        SCHED_TRACE_EVENT(TRACE_WAKEUP, TRACE_PID(thisproc()), p->pid, rq_cpu(target));
+        enqueue_on(rq, target, p);
     }
-    _release_sched_lock();
-    return true;
+    if (rq != target)
+        _release_spinlock(&target->lock);
+    _release_spinlock(&rq->lock);
+    return ret;
 }
 
 static void update_this_state(enum procstate new_state)
 {
     // TODO: if using simple_sched, you should implement this routinue
     // update the state of current process to new_state, and remove it from the sched queue if new_state=SLEEPING/ZOMBIE
-    
-    thisproc()->state = new_state;
-    if (new_state == SLEEPING || new_state == ZOMBIE || new_state == DEEPSLEEPING)
-        _detach_from_list(&thisproc()->schinfo.runnable_queue);
-    
+    // the running process is not on the queue, charge it for the time it ran
+    // and put it back if it is still runnable.
+    auto this = thisproc();
+    struct sched* rq = this_rq();
+    this->state = new_state;
+    if (this->idle)
+        return;
+    if (!is_rt(this)) {
+        u64 delta = get_timestamp() - this->schinfo.exec_start;
+        this->schinfo.vruntime += delta * NICE_0_WEIGHT / this->schinfo.weight;
+    }
+    if (new_state != RUNNABLE)
+        return;
+    if (!allowed_on(this, rq)) {
+        rq->migrate = this;
+        return;
+    }
+    enqueue(rq, this);
+    if (is_rt(this) && rq->need_resched) {
+        // preempted, not yielding: keep its place at the head
+        _detach_from_list(&this->schinfo.rt_node);
+        _insert_into_list(&rq->rt_queue[this->schinfo.rt_priority], &this->schinfo.rt_node);
+    }
 }
 
 static struct proc* pick_next()
 {
-    struct proc* ans = NULL;
-    _for_in_list(p, &runnable_queue){
-        if(p == &runnable_queue) continue;
-        struct proc* candidate = container_of(p, struct proc, schinfo.runnable_queue);
-        if(candidate->state == RUNNABLE){
-            if(!ans) {
-                ans = candidate;
-                break;
-            }
-            else if(ans->schinfo.cnt > candidate->schinfo.cnt) ans = candidate;
-        }
-    }
-    if(ans){
+    struct sched* rq = this_rq();
+    if (rq->nr_running == 0)
+        pull_from_busiest(rq, 1);
+    struct proc* ans = first_rt(rq);
+    if (ans == NULL)
+        ans = first_proc(rq);
+    if (ans) {
+        ASSERT(ans->state == RUNNABLE);
+        dequeue(rq, ans);
+        if (!is_rt(ans) && (i64)(ans->schinfo.vruntime - rq->min_vruntime) > 0)
+            rq->min_vruntime = ans->schinfo.vruntime;
         ans->schinfo.cnt++;
+        ans->schinfo.exec_start = get_timestamp();
         return ans;
     }
     // printk("***********************switch to idle*************************\n");
@@ -166,11 +750,31 @@ static void update_this_proc(struct proc* p)
     // update thisproc to the choosen process, and reset the clock interrupt if need 
     
 
-    cpus[cpuid()].sched.thisproc = p;
-    // _acquire_sched_lock();
-    // if(!p->idle && p->state == RUNNABLE) 
-        set_cpu_timer(p->schinfo.t);
-    // _release_sched_lock();
+    struct sched* rq = this_rq();
+    rq->thisproc = p;
+    if (p->idle) {
+        __atomic_fetch_or(&idle_mask, 1u << cpuid(), __ATOMIC_RELAXED);
+        rcu_idle_enter();
+    } else {
+        __atomic_fetch_and(&idle_mask, ~(1u << cpuid()), __ATOMIC_RELAXED);
+        rcu_idle_exit();
+    }
+    rq->need_resched = false;
+    rq->tick_stopped = true;
+    if (needs_slice(rq, p))
+        start_slice(rq, p);
+}
+
+// the first thing a process does after it is switched to. the process that
+// was switched from is saved now, so it can be queued on another cpu.
+static void finish_switch()
+{
+    struct sched* rq = this_rq();
+    struct proc* p = rq->migrate;
+    rq->migrate = NULL;
+    _release_spinlock(&rq->lock);
+    if (p != NULL)
+        move_proc(p);
 }
 
 const char * print_str = "switch to pid = %d , x0 = %llx, lr = %llx,\n";
@@ -181,8 +785,10 @@ static void simple_sched(enum procstate new_state)
 {
     auto this = thisproc();
     ASSERT(this->state == RUNNING);
+    // nothing read under rcu_read_lock() survives a switch
+    rcu_quiescent_state();
     update_this_state(new_state);
-    if(thisproc()->schinfo.t->triggered == false) cancel_cpu_timer(thisproc()->schinfo.t);
+    if(!this_rq()->tick_stopped && thisproc()->schinfo.t.triggered == false) cancel_cpu_timer(&thisproc()->schinfo.t);
     auto next = pick_next();
     update_this_proc(next);
     // printk("switch to pid = %d, state = %d\n", next->pid, next->state);
@@ -190,19 +796,21 @@ static void simple_sched(enum procstate new_state)
     next->state = RUNNING;
     if (next != this)
     {
+        this_rq()->nr_switch++;
+        SCHED_TRACE_EVENT(TRACE_SWITCH, TRACE_PID(this), new_state, TRACE_PID(next));
         // attach_pgdir(&next->pgdir);
         // printk(print_str, next->pid, next->kcontext->x0,  next->kcontext->lr);
         // printk("switch to pid = %d, state = %d, kcont = %llx, ucont = %llx\n", next->pid, next->state, K2P(next->kcontext), K2P(next->ucontext));
         swtch(next->kcontext, &this->kcontext);
     }
-    _release_sched_lock();
+    finish_switch();
 }
 
 __attribute__((weak, alias("simple_sched"))) void _sched(enum procstate new_state);
 
 u64 proc_entry(void(*entry)(u64), u64 arg)
 {
-    _release_sched_lock();
+    finish_switch();
     set_return_addr(entry);
     return arg;
 }
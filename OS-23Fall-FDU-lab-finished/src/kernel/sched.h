@@ -9,6 +9,18 @@ bool _activate_proc(struct proc*, bool onalert);
 #define alert_proc(proc) _activate_proc(proc, true)
 WARN_RESULT bool is_zombie(struct proc*);
 WARN_RESULT bool is_unused(struct proc*);
+void set_nice(struct proc*, int nice);
+WARN_RESULT int get_nice(struct proc*);
+WARN_RESULT int set_affinity(struct proc*, u32 mask);
+WARN_RESULT u32 get_affinity(struct proc*);
+WARN_RESULT int set_scheduler(struct proc*, int policy, int prio);
+WARN_RESULT int get_scheduler(struct proc*);
+WARN_RESULT int get_rt_priority(struct proc*);
+// give up the cpu if a process of higher priority is waiting for it
+void check_resched();
+// sleep without using the cpu. an alert (kill) ends it early, returns the
+// ms that were left then, 0 if the whole time has passed.
+u64 sleep_ms(u64 ms);
 void _acquire_sched_lock();
 #define lock_for_sched(checker) (checker_begin_ctx(checker), _acquire_sched_lock())
 void _sched(enum procstate new_state);
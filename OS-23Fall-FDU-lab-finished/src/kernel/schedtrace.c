@@ -0,0 +1,81 @@
+#include <kernel/schedtrace.h>
+
+#ifdef SCHED_TRACE
+
+#include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <kernel/syscall.h>
+
+// An event is published like a one-entry seqlock: `seq` is cleared before
+// the event is written and set to its index after, so a reader that sees
+// the same index before and after copying has a consistent copy.
+struct trace_event {
+    u64 seq;                        // index + 1, 0 while being written
+    u64 ts;                         // get_timestamp()
+    u16 type;
+    i32 pid;
+    i32 arg;
+    i32 arg2;
+};
+
+static struct trace_ring {
+    u64 head;                       // events recorded so far
+    struct trace_event ev[SCHED_TRACE_SIZE];
+} __attribute__((aligned(64))) rings[NCPU];
+
+void sched_trace(enum sched_trace_type type, int pid, int arg, int arg2)
+{
+    struct trace_ring* r = &rings[cpuid()];
+    u64 i = r->head;
+    struct trace_event* e = &r->ev[i & (SCHED_TRACE_SIZE - 1)];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts = get_timestamp();
+    e->type = type;
+    e->pid = pid;
+    e->arg = arg;
+    e->arg2 = arg2;
+    __atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, i + 1, __ATOMIC_RELEASE);
+}
+
+static const char* type_name[] = {
+    [TRACE_SWITCH] = "switch",
+    [TRACE_WAKEUP] = "wakeup",
+    [TRACE_TIMER] = "timer",
+};
+
+// the cpus keep recording while we print, events overwritten in the
+// meantime are skipped.
+u64 sched_trace_dump()
+{
+    u64 total = 0;
+    printk("schedtrace: begin freq %llu\n", get_clock_frequency());
+    for (int c = 0; c < NCPU; c++) {
+        struct trace_ring* r = &rings[c];
+        u64 head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        u64 from = head > SCHED_TRACE_SIZE ? head - SCHED_TRACE_SIZE : 0;
+        for (u64 i = from; i < head; i++) {
+            struct trace_event* e = &r->ev[i & (SCHED_TRACE_SIZE - 1)];
+            u64 seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            struct trace_event copy = *e;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (seq != i + 1 || __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+                continue;
+            printk("schedtrace: %d %llu %s %d %d %d\n", c, copy.ts,
+                   type_name[copy.type], copy.pid, copy.arg, copy.arg2);
+            total++;
+        }
+    }
+    printk("schedtrace: end %llu\n", total);
+    return total;
+}
+
+// schedtrace(): print the trace rings to the console.
+define_syscall(schedtrace)
+{
+    return sched_trace_dump();
+}
+
+#endif
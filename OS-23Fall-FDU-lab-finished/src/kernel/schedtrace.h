@@ -0,0 +1,37 @@
+#pragma once
+
+#include <common/defines.h>
+
+// Scheduler event tracing, on by default, `cmake -DSCHED_TRACE=OFF` to
+// compile it out.
+//
+// Every cpu records switches, wakeups and timer fires into its own ring of
+// the most recent SCHED_TRACE_SIZE events. Only the owning cpu writes a
+// ring, so recording takes no lock. schedtrace() prints all rings in the
+// format read by tools/schedtrace.py.
+
+enum sched_trace_type {
+    TRACE_SWITCH,       // pid = prev, arg = state prev left in, arg2 = next
+    TRACE_WAKEUP,       // pid = waker, arg = wakee, arg2 = cpu it is queued on
+    TRACE_TIMER,        // pid = thisproc, arg = ms late, arg2 = elapse
+};
+
+// idle processes have no pid of their own
+#define TRACE_PID(p) ((p)->idle ? -1 : (p)->pid)
+
+#ifdef SCHED_TRACE
+
+#define SCHED_TRACE_SIZE 2048      // events per cpu, a power of 2
+
+void sched_trace(enum sched_trace_type type, int pid, int arg, int arg2);
+
+// print every event still in the rings, returns how many.
+u64 sched_trace_dump();
+
+#define SCHED_TRACE_EVENT(type, pid, arg, arg2) sched_trace(type, pid, arg, arg2)
+
+#else
+
+#define SCHED_TRACE_EVENT(type, pid, arg, arg2)
+
+#endif
@@ -1,8 +1,20 @@
 #pragma once
 
 #include <common/list.h>
+#include <common/rbtree.h>
+#include <common/spinlock.h>
+#include <kernel/timer.h>
 struct proc; // dont include proc.h here
-struct timer;
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024
+
+// scheduling policies, with the values Linux uses
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define MAX_RT_PRIO 64      // real-time priorities are 1 .. MAX_RT_PRIO - 1
 
 // embedded data for cpus
 struct sched
@@ -10,14 +22,38 @@ struct sched
     // TODO: customize your sched info
     struct proc* thisproc;
     struct proc* idle;
+    // the run queue of this cpu. `lock` also protects the state of every
+    // process whose schinfo.cpu is this cpu.
+    SpinLock lock;
+    struct rb_root_ rq; // RUNNABLE processes by vruntime, not the running one
+    ListNode rt_queue[MAX_RT_PRIO]; // RUNNABLE real-time processes
+    u64 rt_bitmap;      // bit i set: rt_queue[i] is not empty
+    bool need_resched;  // thisproc should give up the cpu at the next trap
+    int nr_running;     // number of processes in rq
+    u64 min_vruntime;   // never decreases, new and woken processes start here
+    u64 load;           // sum of the weights in rq
+    bool tick_stopped;  // thisproc runs without a preemption timer
+    struct proc* migrate; // left this cpu, not allowed here any more
+    u64 ticks;          // time slices ended on this cpu
+    u64 nr_switch;      // context switches on this cpu
 };
 
 // embeded data for procs
 struct schinfo
 {
     // TODO: customize your sched info
-    ListNode runnable_queue;
-    struct timer* t;
+    struct rb_node_ rq_node;
+    struct timer t;     // the end of the time slice
     int cnt;
-    int runtime;
+    u64 vruntime;       // time run so far, in get_timestamp() ticks,
+                        // scaled by NICE_0_WEIGHT / weight
+    int nice;           // NICE_MIN .. NICE_MAX, lower runs more
+    u32 weight;         // cpu share relative to NICE_0_WEIGHT
+    int policy;         // SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+    int rt_priority;    // 0 for SCHED_NORMAL, higher runs first
+    ListNode rt_node;
+    u64 exec_start;     // timestamp of the last switch to this process
+    int cpu;            // the run queue this process belongs to
+    u32 affinity;       // bit i set: may run on cpu i
+    bool queued;        // in the rb tree of cpus[cpu].sched
 };
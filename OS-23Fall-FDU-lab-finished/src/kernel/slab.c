@@ -0,0 +1,285 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <common/defines.h>
+#include <common/list.h>
+#include <common/spinlock.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+#include <kernel/kmemtrace.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+
+// Object caches in the style of kmem_cache.
+//
+// Every slab is one page. The slab header sits at the page base, so the slab
+// (and the cache) of any object is found with PAGE_BASE(obj). Objects are
+// handed out through a per-CPU magazine first; the cache lock is only taken
+// to move KMEM_MAG_BATCH objects between a magazine and the slab lists.
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_MAG_SIZE 16
+#define KMEM_MAG_BATCH 8
+#define KMEM_EMPTY_KEEP 1   // empty slabs kept per cache before returning pages
+
+struct slab {
+    struct kmem_cache* cache;
+    ListNode node;          // on partial/full/empty of the cache
+    void* free;             // free objects inside this slab
+    u32 inuse;
+    u32 total;
+};
+
+struct kmem_magazine {
+    int cnt;
+    void* objs[KMEM_MAG_SIZE];
+};
+
+struct kmem_cache {
+    const char* name;
+    usize size;             // slot size, including the free pointer if any
+    usize align;
+    usize fp_off;           // where the free pointer lives inside a slot
+    usize offset;           // of the first object in a slab
+    u32 per_slab;
+    void (*ctor)(void*);
+    SpinLock lock;          // protects the slab lists
+    ListNode partial, full, empty;
+    u32 nr_empty;
+    u32 nr_slabs;
+    struct kmem_magazine mag[NCPU];
+};
+
+// kmem_cache_create only fills in one of these, so caches can be created
+// from early init, before any page can be allocated.
+static struct kmem_cache caches[KMEM_MAX_CACHES];
+static int nr_caches;
+static SpinLock caches_lock;
+
+static INLINE struct slab* slab_of(void* obj)
+{
+    return (struct slab*)PAGE_BASE(obj);
+}
+
+static INLINE void** free_ptr(struct kmem_cache* c, void* obj)
+{
+    return (void**)((u64)obj + c->fp_off);
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, usize size, usize align, void (*ctor)(void*))
+{
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    ASSERT((align & (align - 1)) == 0);
+    _acquire_spinlock(&caches_lock);
+    ASSERT(nr_caches < KMEM_MAX_CACHES);
+    struct kmem_cache* c = &caches[nr_caches++];
+    _release_spinlock(&caches_lock);
+
+    c->name = name;
+    c->align = align;
+    c->ctor = ctor;
+    // a constructed object must keep its contents while it is free,
+    // so the free pointer goes behind the object instead of over it.
+    c->fp_off = ctor ? round_up(size, sizeof(void*)) : 0;
+    c->size = round_up(MAX(c->fp_off + sizeof(void*), size), align);
+    c->offset = round_up(sizeof(struct slab), align);
+    ASSERT(c->offset + c->size <= PAGE_SIZE);
+    c->per_slab = (PAGE_SIZE - c->offset) / c->size;
+    init_spinlock(&c->lock);
+    lockstat_register(&c->lock, name);
+    init_list_node(&c->partial);
+    init_list_node(&c->full);
+    init_list_node(&c->empty);
+    c->nr_empty = c->nr_slabs = 0;
+    for (int i = 0; i < NCPU; i++)
+        c->mag[i].cnt = 0;
+    return c;
+}
+
+static struct slab* new_slab(struct kmem_cache* c)
+{
+    struct slab* s = kalloc_page();
+    if (s == NULL)
+        return NULL;
+    s->cache = c;
+    s->inuse = 0;
+    s->total = c->per_slab;
+    s->free = NULL;
+    for (int i = c->per_slab - 1; i >= 0; i--) {
+        void* obj = (void*)((u64)s + c->offset + i * c->size);
+        if (c->ctor)
+            c->ctor(obj);
+        *free_ptr(c, obj) = s->free;
+        s->free = obj;
+    }
+    c->nr_slabs++;
+    return s;
+}
+
+// take one object from the slab lists. Caller holds c->lock.
+static void* slab_pop(struct kmem_cache* c)
+{
+    struct slab* s;
+    if (!_empty_list(&c->partial)) {
+        s = container_of(c->partial.next, struct slab, node);
+    } else if (!_empty_list(&c->empty)) {
+        s = container_of(c->empty.next, struct slab, node);
+        _detach_from_list(&s->node);
+        _insert_into_list(&c->partial, &s->node);
+        c->nr_empty--;
+    } else {
+        s = new_slab(c);
+        if (s == NULL)
+            return NULL;
+        _insert_into_list(&c->partial, &s->node);
+    }
+    void* obj = s->free;
+    s->free = *free_ptr(c, obj);
+    if (++s->inuse == s->total) {
+        _detach_from_list(&s->node);
+        _insert_into_list(&c->full, &s->node);
+    }
+    return obj;
+}
+
+// give one object back to its slab. Caller holds c->lock.
+static void slab_push(struct kmem_cache* c, void* obj)
+{
+    struct slab* s = slab_of(obj);
+    ASSERT(s->cache == c);
+    if (s->inuse-- == s->total) {
+        _detach_from_list(&s->node);
+        _insert_into_list(&c->partial, &s->node);
+    }
+    *free_ptr(c, obj) = s->free;
+    s->free = obj;
+    if (s->inuse == 0) {
+        _detach_from_list(&s->node);
+        if (c->nr_empty < KMEM_EMPTY_KEEP) {
+            _insert_into_list(&c->empty, &s->node);
+            c->nr_empty++;
+        } else {
+            c->nr_slabs--;
+            kfree_page(s);
+        }
+    }
+}
+
+void* kmem_cache_alloc(struct kmem_cache* c)
+{
+    struct kmem_magazine* m = &c->mag[cpuid()];
+    if (m->cnt == 0) {
+        _acquire_spinlock(&c->lock);
+        while (m->cnt < KMEM_MAG_BATCH) {
+            void* obj = slab_pop(c);
+            if (obj == NULL)
+                break;
+            m->objs[m->cnt++] = obj;
+        }
+        _release_spinlock(&c->lock);
+        if (m->cnt == 0)
+            return NULL;
+    }
+    void* obj = m->objs[--m->cnt];
+    KMEM_TRACE_ALLOC(obj, c->size, c->size);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache* c, void* obj)
+{
+    KMEM_TRACE_FREE(obj);
+    struct kmem_magazine* m = &c->mag[cpuid()];
+    if (m->cnt == KMEM_MAG_SIZE) {
+        _acquire_spinlock(&c->lock);
+        for (int i = 0; i < KMEM_MAG_BATCH; i++)
+            slab_push(c, m->objs[i]);
+        _release_spinlock(&c->lock);
+        m->cnt -= KMEM_MAG_BATCH;
+        for (int i = 0; i < m->cnt; i++)
+            m->objs[i] = m->objs[i + KMEM_MAG_BATCH];
+    }
+    m->objs[m->cnt++] = obj;
+}
+
+// print how full the slabs of every cache are. Objects sitting in a
+// magazine count as free.
+void kmem_cache_dump()
+{
+    _acquire_spinlock(&caches_lock);
+    int n = nr_caches;
+    _release_spinlock(&caches_lock);
+    for (int i = 0; i < n; i++) {
+        struct kmem_cache* c = &caches[i];
+        u64 inuse = 0;
+        _acquire_spinlock(&c->lock);
+        _for_in_list(p, &c->partial)
+        {
+            if (p != &c->partial)
+                inuse += container_of(p, struct slab, node)->inuse;
+        }
+        _for_in_list(p, &c->full)
+        {
+            if (p != &c->full)
+                inuse += container_of(p, struct slab, node)->inuse;
+        }
+        u64 slabs = c->nr_slabs;
+        _release_spinlock(&c->lock);
+        for (int j = 0; j < NCPU; j++)
+            inuse -= c->mag[j].cnt;
+        if (slabs == 0)
+            continue;
+        printk("  cache %s/%llu: %llu slabs, %llu of %llu objects in use\n",
+               c->name, (u64)c->size, slabs, inuse, slabs * c->per_slab);
+    }
+}
+
+// general purpose caches behind kalloc/kfree.
+static const usize kmalloc_sizes[] = {8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048};
+#define NR_KMALLOC_CACHES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+static struct kmem_cache* kmalloc_caches[NR_KMALLOC_CACHES];
+
+define_early_init(kmalloc)
+{
+    for (usize i = 0; i < NR_KMALLOC_CACHES; i++)
+        kmalloc_caches[i] = kmem_cache_create("kmalloc", kmalloc_sizes[i], 8, NULL);
+}
+
+static int size_to_order(usize size)
+{
+    int order = 0;
+    while (((usize)PAGE_SIZE << order) < size)
+        order++;
+    return order;
+}
+
+void* kalloc(isize size)
+{
+    for (usize i = 0; i < NR_KMALLOC_CACHES; i++) {
+        if ((usize)size <= kmalloc_sizes[i]) {
+            void* p = kmem_cache_alloc(kmalloc_caches[i]);
+            KMEM_TRACE_ALLOC(p, size, kmalloc_sizes[i]);
+            return p;
+        }
+    }
+    // larger objects take whole buddy blocks. The order is kept in
+    // page_refs, so kfree does not need the size.
+    int order = size_to_order(size);
+    if (order > MAX_ORDER)
+        return NULL;
+    void* p = kalloc_pages(order);
+    KMEM_TRACE_ALLOC(p, size, PAGE_SIZE << order);
+    return p;
+}
+
+void kfree(void* p)
+{
+    if (p == NULL)
+        return;
+    // slab objects never start at the page base, that is where the
+    // slab header lives; a page aligned pointer is a buddy block.
+    if (PAGE_BASE(p) == (u64)p) {
+        kfree_pages(p, get_page_order(p));
+        return;
+    }
+    kmem_cache_free(slab_of(p)->cache, p);
+}
@@ -1,9 +1,23 @@
 #pragma once
 #include <sys/syscall.h>
 
+#define SYS_futex 98
+#define SYS_nanosleep 101
+#define SYS_clock_nanosleep 115
+#define SYS_sched_setparam 118
+#define SYS_sched_setscheduler 119
+#define SYS_sched_getscheduler 120
+#define SYS_sched_getparam 121
+#define SYS_sched_setaffinity 122
+#define SYS_sched_getaffinity 123
 #define SYS_yield 124
+#define SYS_setpriority 140
+#define SYS_getpriority 141
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_kmemtrace 501
+#define SYS_lockstat 502
+#define SYS_schedtrace 503
 #define SYS_sbrk 12
 #define SYS_brk 214
 #define SYS_mprotect 226
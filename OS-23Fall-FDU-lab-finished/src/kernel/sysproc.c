@@ -1,9 +1,15 @@
+#include <common/lockstat.h>
+#include <driver/clock.h>
+#include <kernel/cpu.h>
+#include <kernel/futex.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
 #include <kernel/syscall.h>
+#include <errno.h>
+#include <time.h>
 
 define_syscall(gettid) { return thisproc()->pid; }
 
@@ -28,6 +34,236 @@ define_syscall(yield) {
 
 define_syscall(pstat) { return (u64)left_page_cnt(); }
 
+// the process a scheduling syscall is about, 0 means the caller.
+// release it with put_target().
+static struct proc *get_target(int pid) {
+    if (pid == 0 || pid == thisproc()->pid)
+        return thisproc();
+    return find_proc(pid);
+}
+
+static void put_target(struct proc *p) {
+    if (p != thisproc())
+        put_proc(p);
+}
+
+#define PRIO_PROCESS 0
+
+define_syscall(setpriority, int which, int who, int prio) {
+    if (which != PRIO_PROCESS)
+        return -1;
+    struct proc *p = get_target(who);
+    if (p == NULL)
+        return -1;
+    set_nice(p, prio);
+    put_target(p);
+    return 0;
+}
+
+// like Linux, return 20 - nice so that the result is never negative.
+define_syscall(getpriority, int which, int who) {
+    if (which != PRIO_PROCESS)
+        return -1;
+    struct proc *p = get_target(who);
+    if (p == NULL)
+        return -1;
+    int nice = get_nice(p);
+    put_target(p);
+    return 20 - nice;
+}
+
+struct sched_param {
+    int sched_priority;
+};
+
+// errors of the scheduling syscalls below are negated errno values, as
+// musl expects.
+define_syscall(sched_setscheduler, int pid, int policy,
+               struct sched_param *param) {
+    if (param == NULL)
+        return -EINVAL;
+    if (!user_readable(param, sizeof(*param)))
+        return -EFAULT;
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    int ret = set_scheduler(p, policy, param->sched_priority);
+    put_target(p);
+    return ret == 0 ? 0 : -EINVAL;
+}
+
+define_syscall(sched_setparam, int pid, struct sched_param *param) {
+    if (param == NULL)
+        return -EINVAL;
+    if (!user_readable(param, sizeof(*param)))
+        return -EFAULT;
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    int ret = set_scheduler(p, get_scheduler(p), param->sched_priority);
+    put_target(p);
+    return ret == 0 ? 0 : -EINVAL;
+}
+
+define_syscall(sched_getscheduler, int pid) {
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    int policy = get_scheduler(p);
+    put_target(p);
+    return policy;
+}
+
+define_syscall(sched_getparam, int pid, struct sched_param *param) {
+    if (param == NULL)
+        return -EINVAL;
+    if (!user_writeable(param, sizeof(*param)))
+        return -EFAULT;
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    param->sched_priority = get_rt_priority(p);
+    put_target(p);
+    return 0;
+}
+
+// a cpu_set_t of any size, only the first NCPU bits mean anything.
+define_syscall(sched_setaffinity, int pid, usize size, u8 *mask) {
+    if (size == 0)
+        return -EINVAL;
+    if (!user_readable(mask, size))
+        return -EFAULT;
+    u32 cpus = 0;
+    for (int i = 0; i < NCPU && (usize)i < size * 8; i++)
+        if (mask[i / 8] & (1 << (i % 8)))
+            cpus |= 1u << i;
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    int ret = set_affinity(p, cpus);
+    put_target(p);
+    return ret == 0 ? 0 : -EINVAL;
+}
+
+// returns the number of bytes written, as Linux does.
+define_syscall(sched_getaffinity, int pid, usize size, u8 *mask) {
+    usize n = (NCPU + 7) / 8;
+    if (size < n)
+        return -EINVAL;
+    if (!user_writeable(mask, n))
+        return -EFAULT;
+    struct proc *p = get_target(pid);
+    if (p == NULL)
+        return -ESRCH;
+    u32 cpus = get_affinity(p);
+    put_target(p);
+    for (usize i = 0; i < n; i++)
+        mask[i] = (u8)(cpus >> (8 * i));
+    return n;
+}
+
+// rounded up, the timers have 1 ms resolution.
+static u64 timespec_to_ms(const struct timespec *ts) {
+    return ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000;
+}
+
+static bool timespec_valid(const struct timespec *ts) {
+    return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000;
+}
+
+// errors are negated errno values, as musl expects.
+static int do_nanosleep(u64 ms, struct timespec *rem) {
+    u64 left = sleep_ms(ms);
+    if (left == 0)
+        return 0;
+    if (rem) {
+        rem->tv_sec = left / 1000;
+        rem->tv_nsec = left % 1000 * 1000000;
+    }
+    return -EINTR;
+}
+
+define_syscall(nanosleep, const struct timespec *req, struct timespec *rem) {
+    if (!user_readable(req, sizeof(*req)))
+        return -EFAULT;
+    if (!timespec_valid(req))
+        return -EINVAL;
+    if (rem && !user_writeable(rem, sizeof(*rem)))
+        return -EFAULT;
+    return do_nanosleep(timespec_to_ms(req), rem);
+}
+
+// there is no real-time clock, CLOCK_REALTIME counts from boot as
+// CLOCK_MONOTONIC does.
+define_syscall(clock_nanosleep, int clock, int flags,
+               const struct timespec *req, struct timespec *rem) {
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC)
+        return -EINVAL;
+    if (!user_readable(req, sizeof(*req)))
+        return -EFAULT;
+    if (!timespec_valid(req))
+        return -EINVAL;
+    u64 ms = timespec_to_ms(req);
+    if (flags & TIMER_ABSTIME) {
+        u64 now = get_timestamp_ms();
+        ms = ms > now ? ms - now : 0;
+        // the deadline stays the same, nothing to report
+        rem = NULL;
+    }
+    if (rem && !user_writeable(rem, sizeof(*rem)))
+        return -EFAULT;
+    return do_nanosleep(ms, rem);
+}
+
+// the timeout is relative for FUTEX_WAIT and a deadline for
+// FUTEX_WAIT_BITSET. For the requeue operations it holds a count instead.
+// Both clocks are the same, see clock_nanosleep. Keys are physical
+// addresses, so private futexes need nothing special.
+define_syscall(futex, u32 *uaddr, int op, u32 val,
+               const struct timespec *timeout, u32 *uaddr2, u32 val3) {
+    int cmd = op & FUTEX_CMD_MASK;
+    if (!user_writeable(uaddr, sizeof(*uaddr)))
+        return -EFAULT;
+    if ((op & FUTEX_CLOCK_REALTIME) && cmd != FUTEX_WAIT_BITSET)
+        return -ENOSYS;
+    switch (cmd) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET: {
+        u64 ms = FUTEX_NO_TIMEOUT;
+        if (timeout) {
+            if (!user_readable(timeout, sizeof(*timeout)))
+                return -EFAULT;
+            if (!timespec_valid(timeout))
+                return -EINVAL;
+            ms = timespec_to_ms(timeout);
+            if (cmd == FUTEX_WAIT_BITSET) {
+                u64 now = get_timestamp_ms();
+                ms = ms > now ? ms - now : 0;
+            }
+        }
+        return futex_wait(uaddr, val,
+                          cmd == FUTEX_WAIT ? FUTEX_BITSET_MATCH_ANY : val3, ms);
+    }
+    case FUTEX_WAKE:
+        return futex_wake(uaddr, (int)val, FUTEX_BITSET_MATCH_ANY);
+    case FUTEX_WAKE_BITSET:
+        return futex_wake(uaddr, (int)val, val3);
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+        if (!user_writeable(uaddr2, sizeof(*uaddr2)))
+            return -EFAULT;
+        return futex_requeue(uaddr, (int)val, (int)(u64)timeout, uaddr2,
+                             cmd == FUTEX_CMP_REQUEUE ? &val3 : NULL);
+    default:
+        return -ENOSYS;
+    }
+}
+
+#ifdef LOCKSTAT
+// print the n most contended locks to the console.
+define_syscall(lockstat, int n) { return lockstat_dump(n); }
+#endif
+
 define_syscall(sbrk, i64 size) { return sbrk(size); }
 
 define_syscall(clone, int flag, void *childstk) {
@@ -0,0 +1,135 @@
+#include <kernel/timer.h>
+
+#define WHEEL_RANGE (1ull << (WHEEL_BITS * WHEEL_LEVELS))
+
+void init_timer_wheel(struct timer_wheel* w, u64 now)
+{
+    w->clk = now;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        w->bitmap[level] = 0;
+        for (int i = 0; i < WHEEL_SIZE; i++)
+            init_list_node(&w->slot[level][i]);
+    }
+    init_list_node(&w->expired);
+}
+
+// A timer is put in the level where its expiry is less than one round of
+// the level ahead of clk. The slot it lands in then comes round, and is
+// cascaded, no later than the expiry and after clk.
+static void wheel_insert(struct timer_wheel* w, struct timer* t)
+{
+    u64 expires = t->_key;
+    if ((i64)(expires - w->clk) < 0)
+        expires = w->clk;
+    u64 delta = expires - w->clk;
+    if (delta >= WHEEL_RANGE) {
+        // too far away: wait in the last slot, it is put back from there
+        expires = w->clk + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+    int level = 0;
+    while (delta >> (WHEEL_BITS * (level + 1)))
+        level++;
+    int idx = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    _insert_into_list(w->slot[level][idx].prev, &t->_node);
+    w->bitmap[level] |= 1ull << idx;
+    t->_slot = level * WHEEL_SIZE + idx;
+}
+
+static bool wheel_empty(struct timer_wheel* w)
+{
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        if (w->bitmap[level] != 0)
+            return false;
+    return _empty_list(&w->expired);
+}
+
+// nothing advances an empty wheel while its cpu takes no clock interrupts,
+// so move it to `now` here rather than slot by slot at the next interrupt.
+void timer_wheel_add(struct timer_wheel* w, struct timer* t, u64 now)
+{
+    if ((i64)(now - w->clk) > 0 && wheel_empty(w))
+        w->clk = now;
+    wheel_insert(w, t);
+}
+
+// also works for a timer on the expired list: its old slot is empty or
+// holds other timers, and the bit is right either way.
+void timer_wheel_del(struct timer_wheel* w, struct timer* t)
+{
+    int level = t->_slot / WHEEL_SIZE, idx = t->_slot % WHEEL_SIZE;
+    _detach_from_list(&t->_node);
+    if (_empty_list(&w->slot[level][idx]))
+        w->bitmap[level] &= ~(1ull << idx);
+}
+
+// clk is a multiple of WHEEL_SIZE: refill the lower levels from the slots
+// that start now.
+static void cascade(struct timer_wheel* w)
+{
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int idx = (w->clk >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        ListNode* head = &w->slot[level][idx];
+        w->bitmap[level] &= ~(1ull << idx);
+        while (!_empty_list(head)) {
+            struct timer* t = container_of(head->next, struct timer, _node);
+            _detach_from_list(&t->_node);
+            wheel_insert(w, t);
+        }
+        if (idx != 0)
+            break;
+    }
+}
+
+// process every ms up to `now`, skipping the empty slots of level 0.
+static void wheel_advance(struct timer_wheel* w, u64 now)
+{
+    while ((i64)(w->clk - now) <= 0) {
+        int idx = w->clk & WHEEL_MASK;
+        if (idx == 0)
+            cascade(w);
+        if (w->bitmap[0] & (1ull << idx)) {
+            // move the whole slot to the end of the expired list
+            ListNode* head = &w->slot[0][idx];
+            ListNode* first = head->next;
+            _detach_from_list(head);
+            _merge_list(w->expired.prev, first);
+            w->bitmap[0] &= ~(1ull << idx);
+        }
+        u64 rest = w->bitmap[0] & ~((2ull << idx) - 1);
+        u64 next = rest ? (w->clk & ~(u64)WHEEL_MASK) + __builtin_ctzll(rest)
+                        : (w->clk | WHEEL_MASK) + 1;
+        w->clk = MIN(next, now + 1);
+    }
+}
+
+struct timer* timer_wheel_expire(struct timer_wheel* w, u64 now)
+{
+    if (_empty_list(&w->expired))
+        wheel_advance(w, now);
+    if (_empty_list(&w->expired))
+        return NULL;
+    struct timer* t = container_of(w->expired.next, struct timer, _node);
+    _detach_from_list(&t->_node);
+    return t;
+}
+
+// For each level, the slots come round in order from the first slot
+// boundary at or after clk, so rotate the bitmap to start there.
+u64 timer_wheel_next(struct timer_wheel* w)
+{
+    if (!_empty_list(&w->expired))
+        return w->clk;
+    u64 next = WHEEL_NONE;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        u64 bits = w->bitmap[level];
+        if (bits == 0)
+            continue;
+        int shift = WHEEL_BITS * level;
+        u64 start = round_up(w->clk, 1ull << shift);
+        int idx = (start >> shift) & WHEEL_MASK;
+        u64 rot = (bits >> idx) | (bits << ((WHEEL_SIZE - idx) & WHEEL_MASK));
+        next = MIN(next, start + ((u64)__builtin_ctzll(rot) << shift));
+    }
+    return next;
+}
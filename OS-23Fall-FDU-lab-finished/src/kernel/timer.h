@@ -0,0 +1,44 @@
+#pragma once
+
+#include <common/list.h>
+
+// A hierarchical timing wheel with 1 ms resolution.
+// Level k has WHEEL_SIZE slots of WHEEL_SIZE^k ms each. A timer sits in the
+// lowest level whose range covers its expiry. When the clock reaches the
+// start of a slot above level 0, its timers are put back into the levels
+// below (a cascade). Add and delete are O(1), and a timer is moved at most
+// WHEEL_LEVELS - 1 times before it expires.
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4      // 2^24 ms ahead, later timers wait at the end
+#define WHEEL_NONE ((u64)-1)
+
+struct timer
+{
+    bool triggered;
+    int elapse;
+    u64 _key;               // expiry, in ms
+    ListNode _node;
+    int _slot;              // level * WHEEL_SIZE + index in the level
+    int _cpu;               // the wheel it is on, see set_cpu_timer()
+    bool _running;          // the handler has not returned yet
+    void (*handler)(struct timer*);
+    u64 data;
+};
+
+struct timer_wheel
+{
+    u64 clk;                // the first ms that is not processed yet
+    u64 bitmap[WHEEL_LEVELS]; // bit i set: slot[level][i] is not empty
+    ListNode slot[WHEEL_LEVELS][WHEEL_SIZE];
+    ListNode expired;       // due, not handed out yet
+};
+
+void init_timer_wheel(struct timer_wheel* w, u64 now);
+void timer_wheel_add(struct timer_wheel* w, struct timer* t, u64 now);
+void timer_wheel_del(struct timer_wheel* w, struct timer* t);
+// take one timer that expires at or before `now`, NULL if there is none.
+struct timer* timer_wheel_expire(struct timer_wheel* w, u64 now);
+// the earliest ms at which the wheel has work to do, WHEEL_NONE if empty.
+u64 timer_wheel_next(struct timer_wheel* w);
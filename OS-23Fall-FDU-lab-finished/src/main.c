@@ -12,12 +12,25 @@ static bool boot_secondary_cpus = false;
 
 NO_RETURN void idle_entry();
 
+static u64 boot_us(u64 from, u64 to)
+{
+    return (to - from) * 1000000 / get_clock_frequency();
+}
+
 void kernel_init()
 {
     extern char edata[], end[];
+    // boot phase timestamps. Locals, since .bss is cleared right below.
+    u64 t[4];
+    t[0] = get_timestamp();
     memset(edata, 0, (usize)(end - edata));
+    t[1] = get_timestamp();
     do_early_init();
+    t[2] = get_timestamp();
     do_init();
+    t[3] = get_timestamp();
+    printk("boot: bss %lld us, early init %lld us, init %lld us\n",
+           boot_us(t[0], t[1]), boot_us(t[1], t[2]), boot_us(t[2], t[3]));
     boot_secondary_cpus = true;
 }
 
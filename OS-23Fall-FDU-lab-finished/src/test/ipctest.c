@@ -3,6 +3,8 @@
 #include "kernel/printk.h"
 #include "kernel/proc.h"
 #include "kernel/mem.h"
+#include "fs/file.h"
+#include "fs/pipe.h"
 struct mytype {
     int mtype;
     int sum;
@@ -52,4 +54,58 @@ void ipc_test() {
     for (int i = 1; i < 10001; i++)
         ASSERT(msg[i] == -i);
     printk("ipc_test PASS\n");
-}
\ No newline at end of file
+}
+void set_parent_to_this(struct proc* proc);
+
+#define NR_PIPE_READERS 8
+#define PIPE_CHUNK 64
+#define PIPE_ROUNDS 512
+
+static Pipe* bench_pipe;
+static u64 pipe_sum[NR_PIPE_READERS];
+
+static void pipe_reader(u64 id) {
+    char buf[PIPE_CHUNK];
+    for (int i = 0; i < PIPE_ROUNDS; i++) {
+        ASSERT(pipeRead(bench_pipe, (u64)buf, PIPE_CHUNK) == PIPE_CHUNK);
+        for (int j = 0; j < PIPE_CHUNK; j++)
+            pipe_sum[id] += (u8)buf[j];
+    }
+    exit(0);
+}
+
+// many readers on one pipe: count how many processes are woken for each
+// read or write that completes.
+void pipe_wakeup_bench() {
+    File *rf, *wf;
+    char buf[PIPE_CHUNK];
+    u64 sum = 0, got = 0;
+    int code;
+    ASSERT(pipeAlloc(&rf, &wf) == 0);
+    bench_pipe = rf->pipe;
+    for (int i = 0; i < NR_PIPE_READERS; i++) {
+        pipe_sum[i] = 0;
+        struct proc* p = create_proc();
+        set_parent_to_this(p);
+        start_proc(p, pipe_reader, i);
+    }
+    for (int i = 0; i < NR_PIPE_READERS * PIPE_ROUNDS; i++) {
+        for (int j = 0; j < PIPE_CHUNK; j++) {
+            buf[j] = (char)(i + j);
+            sum += (u8)buf[j];
+        }
+        ASSERT(pipeWrite(bench_pipe, (u64)buf, PIPE_CHUNK) == PIPE_CHUNK);
+    }
+    for (int i = 0; i < NR_PIPE_READERS; i++)
+        ASSERT(wait(&code) != -1);
+    for (int i = 0; i < NR_PIPE_READERS; i++)
+        got += pipe_sum[i];
+    ASSERT(got == sum);
+    u64 ops = 2 * NR_PIPE_READERS * PIPE_ROUNDS;
+    u64 wakeups = bench_pipe->rwait.nr_wakeups + bench_pipe->wwait.nr_wakeups;
+    printk("%d readers: %llu wakeups for %llu pipe ops, %llu per 100 ops\n",
+           NR_PIPE_READERS, wakeups, ops, wakeups * 100 / ops);
+    file_close(rf);
+    file_close(wf);
+    printk("pipe_wakeup_bench PASS\n");
+}
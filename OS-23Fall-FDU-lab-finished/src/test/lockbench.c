@@ -0,0 +1,188 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/sem.h>
+#include <common/spinlock.h>
+#include <driver/clock.h>
+#include <errno.h>
+#include <kernel/cpu.h>
+#include <kernel/futex.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+#define SYNC(i)                                                                \
+    arch_dsb_sy();                                                             \
+    _increment_rc(&x);                                                         \
+    while (x.count < 4 * i)                                                    \
+        ;                                                                      \
+    arch_dsb_sy();
+
+#define BENCH_MS 200
+
+static RefCount x;
+static SpinLock lock;
+static u64 shared;
+static u64 acquired[4];
+
+// all CPUs hammer one lock for BENCH_MS with a tiny critical section.
+void lock_bench() {
+    int i = cpuid();
+    if (i == 0) {
+#ifdef TICKET_SPINLOCK
+        printk("lock_bench: ticket spinlock\n");
+#else
+        printk("lock_bench: test-and-set spinlock\n");
+#endif
+        init_spinlock(&lock);
+    }
+    SYNC(1)
+    u64 end = get_timestamp() + get_clock_frequency() / 1000 * BENCH_MS;
+    u64 n = 0;
+    while (get_timestamp() < end) {
+        _acquire_spinlock(&lock);
+        shared++;
+        _release_spinlock(&lock);
+        n++;
+    }
+    acquired[i] = n;
+    SYNC(2)
+    if (i == 0) {
+        u64 total = 0, min = acquired[0], max = acquired[0];
+        for (int j = 0; j < 4; j++) {
+            total += acquired[j];
+            min = MIN(min, acquired[j]);
+            max = MAX(max, acquired[j]);
+        }
+        if (total != shared)
+            FAIL("FAIL: %llu acquisitions but counter is %llu\n", total, shared);
+        printk("%llu acquisitions/s, per CPU min %llu max %llu\n",
+               total * 1000 / BENCH_MS, min, max);
+        printk("lock_bench PASS\n");
+    }
+}
+
+#define PINGPONG_ROUNDS 10000
+
+void set_parent_to_this(struct proc* proc);
+
+static Semaphore ping, pong;
+
+static void ponger(u64 rounds) {
+    for (u64 i = 0; i < rounds; i++) {
+        unalertable_wait_sem(&ping);
+        post_sem(&pong);
+    }
+    exit(0);
+}
+
+// ns per round trip between the caller on `from` and a process on `to`,
+// each side sleeping on a semaphore until the other posts it.
+static u64 sem_pingpong(int from, int to) {
+    int code;
+    init_sem(&ping, 0);
+    init_sem(&pong, 0);
+    ASSERT(set_affinity(thisproc(), 1u << from) == 0);
+    auto p = create_proc();
+    set_parent_to_this(p);
+    start_proc_pinned(p, to, ponger, PINGPONG_ROUNDS);
+    u64 start = get_timestamp();
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        post_sem(&ping);
+        unalertable_wait_sem(&pong);
+    }
+    u64 t = get_timestamp() - start;
+    if (wait(&code) == -1)
+        FAIL("FAIL: lost the ponger\n");
+    return t * 1000000000 / get_clock_frequency() / PINGPONG_ROUNDS;
+}
+
+// the handoff cost of the semaphore sleep path, on one cpu and across two.
+// run it from a kernel process.
+void sem_pingpong_bench() {
+    u32 old = get_affinity(thisproc());
+    u64 local = sem_pingpong(0, 0);
+    u64 remote = sem_pingpong(0, 1);
+    ASSERT(set_affinity(thisproc(), old) == 0);
+    printk("semaphore round trip: %llu ns on one cpu, %llu ns across cpus\n",
+           local, remote);
+    printk("sem_pingpong_bench PASS\n");
+}
+
+#define FUTEX_WORKERS 8
+#define FUTEX_ROUNDS 2000
+
+// a futex mutex: 0 free, 1 held, 2 held and somebody may be asleep.
+static u32 fmutex;
+static u64 fcounter, fsleeps;
+
+static void fmutex_lock() {
+    u32 c = 0;
+    if (__atomic_compare_exchange_n(&fmutex, &c, 1, false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED))
+        return;
+    if (c != 2)
+        c = __atomic_exchange_n(&fmutex, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        if (futex_wait(&fmutex, 2, FUTEX_BITSET_MATCH_ANY, FUTEX_NO_TIMEOUT) == 0)
+            __atomic_fetch_add(&fsleeps, 1, __ATOMIC_RELAXED);
+        c = __atomic_exchange_n(&fmutex, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void fmutex_unlock() {
+    if (__atomic_exchange_n(&fmutex, 0, __ATOMIC_RELEASE) == 2)
+        futex_wake(&fmutex, 1, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_worker(u64 rounds) {
+    for (u64 i = 0; i < rounds; i++) {
+        fmutex_lock();
+        u64 v = fcounter;
+        // give up the cpu now and then while holding the lock, so that
+        // the others have to sleep on it
+        if (i % 64 == 0)
+            yield();
+        fcounter = v + 1;
+        fmutex_unlock();
+    }
+    exit(0);
+}
+
+// a futex mutex shared by more processes than cpus must not lose an
+// update, and a wait has to time out and check the value.
+void futex_test() {
+    int code;
+    u32 word = 0;
+    if (futex_wait(&word, 1, FUTEX_BITSET_MATCH_ANY, 20) != -EAGAIN)
+        FAIL("FAIL: futex_wait slept on a changed value\n");
+    u64 start = get_timestamp_ms();
+    if (futex_wait(&word, 0, FUTEX_BITSET_MATCH_ANY, 20) != -ETIMEDOUT)
+        FAIL("FAIL: futex_wait did not time out\n");
+    if (get_timestamp_ms() - start < 20)
+        FAIL("FAIL: futex_wait timed out early\n");
+    if (futex_wake(&word, 1, FUTEX_BITSET_MATCH_ANY) != 0)
+        FAIL("FAIL: woke a waiter that is gone\n");
+    fmutex = 0;
+    fcounter = fsleeps = 0;
+    for (int i = 0; i < FUTEX_WORKERS; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc(p, futex_worker, FUTEX_ROUNDS);
+    }
+    for (int i = 0; i < FUTEX_WORKERS; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a futex worker\n");
+    if (fcounter != FUTEX_WORKERS * FUTEX_ROUNDS)
+        FAIL("FAIL: counter is %llu, expected %d\n", fcounter,
+             FUTEX_WORKERS * FUTEX_ROUNDS);
+    printk("futex mutex: %d acquisitions, %llu sleeps\n",
+           FUTEX_WORKERS * FUTEX_ROUNDS, fsleeps);
+    printk("futex_test PASS\n");
+}
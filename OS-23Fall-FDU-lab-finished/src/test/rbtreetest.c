@@ -61,5 +61,16 @@ void rbtree_test() {
     while (x.count < 8)
         ;
     arch_dsb_sy();
-    if (cid == 0) printk("rbtree_test PASS\n");
+    if (cid == 0) {
+        // in-order walk sees every key once, in increasing order
+        int n = 0, last = -1;
+        for (rb_node np = _rb_first(&rt); np != NULL; np = _rb_next(np)) {
+            int key = container_of(np, struct mytype, node)->key;
+            if (key <= last) FAIL("_rb_next out of order %d %d\n", last, key);
+            last = key;
+            n++;
+        }
+        if (n != 4000) FAIL("_rb_next walked %d nodes\n", n);
+        printk("rbtree_test PASS\n");
+    }
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/rcu.h>
+#include <common/rwlock.h>
+#include <common/spinlock.h>
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+#define SYNC(i)                                                                \
+    arch_dsb_sy();                                                             \
+    _increment_rc(&x);                                                         \
+    while (x.count < NCPU * i)                                                 \
+        ;                                                                      \
+    arch_dsb_sy();
+
+#define BENCH_MS 200
+#define NR_OBJS 64
+#define WRITE_EVERY 1024    // worker 0 replaces an object this often
+
+#define OBJ_ALIVE 0x600d
+#define OBJ_DEAD 0xdead
+
+struct obj {
+    ListNode node;
+    u64 key;
+    u64 magic;
+    struct rcu_head rcu;
+};
+
+enum { USE_RWLOCK, USE_RCU, USE_FIND_PROC, NR_KINDS };
+static const char* kind_name[NR_KINDS] = {"rwlock list", "rcu list",
+                                          "find_proc"};
+
+void set_parent_to_this(struct proc* proc);
+
+static RefCount x;
+static ListNode objs;
+static RWLock objs_rwlock;
+static SpinLock objs_lock;      // the writer side of the rcu list
+static int worker_pid[NCPU];
+static u64 reads[NCPU];
+static u64 result[NR_KINDS][NCPU];
+
+static struct obj* new_obj(u64 key) {
+    struct obj* o = kalloc(sizeof(struct obj));
+    o->key = key;
+    o->magic = OBJ_ALIVE;
+    return o;
+}
+
+static void kill_obj(struct obj* o) {
+    o->magic = OBJ_DEAD;
+    kfree(o);
+}
+
+static void free_obj(struct rcu_head* head) {
+    kill_obj(container_of(head, struct obj, rcu));
+}
+
+static struct obj* find_obj(u64 key) {
+    _for_in_list(p, &objs) {
+        if (p == &objs)
+            continue;
+        struct obj* o = container_of(p, struct obj, node);
+        if (o->key == key)
+            return o;
+    }
+    return NULL;
+}
+
+static void check_obj(struct obj* o) {
+    if (o != NULL && o->magic != OBJ_ALIVE)
+        FAIL("FAIL: a reader saw freed object %llu\n", o->key);
+}
+
+static void lookup(int kind, u64 key) {
+    switch (kind) {
+    case USE_RWLOCK:
+        _acquire_read_lock(&objs_rwlock);
+        check_obj(find_obj(key));
+        _release_read_lock(&objs_rwlock);
+        break;
+    case USE_RCU: {
+        struct obj* found = NULL;
+        rcu_read_lock();
+        rcu_for_in_list(p, &objs) {
+            struct obj* o = container_of(p, struct obj, node);
+            if (o->key == key) {
+                found = o;
+                break;
+            }
+        }
+        check_obj(found);
+        rcu_read_unlock();
+        break;
+    }
+    default: {
+        struct proc* p = find_proc(worker_pid[key % NCPU]);
+        if (p == NULL)
+            FAIL("FAIL: lost a worker\n");
+        put_proc(p);
+        break;
+    }
+    }
+}
+
+// put a new object in place of the one with `key`. The new one goes in
+// first, so a reader always finds the key.
+static void replace(int kind, u64 key) {
+    struct obj* o = new_obj(key);
+    if (kind == USE_RWLOCK) {
+        _acquire_write_lock(&objs_rwlock);
+        struct obj* old = find_obj(key);
+        _insert_into_list(&objs, &o->node);
+        _detach_from_list(&old->node);
+        _release_write_lock(&objs_rwlock);
+        kill_obj(old);
+    } else {
+        _acquire_spinlock(&objs_lock);
+        struct obj* old = find_obj(key);
+        rcu_insert_into_list(&objs, &o->node);
+        rcu_detach_from_list(&old->node);
+        _release_spinlock(&objs_lock);
+        call_rcu(&old->rcu, free_obj);
+    }
+}
+
+static void bench_worker(u64 i) {
+    int round = 0;
+    SYNC(++round)
+    for (int kind = 0; kind < NR_KINDS; kind++) {
+        for (int ncpu = 1; ncpu <= NCPU; ncpu++) {
+            u64 n = 0, ops = 0;
+            u64 end = get_timestamp() + get_clock_frequency() / 1000 * BENCH_MS;
+            while (i < (u64)ncpu && get_timestamp() < end) {
+                if (i == 0 && kind != USE_FIND_PROC && ++ops % WRITE_EVERY == 0)
+                    replace(kind, ops / WRITE_EVERY % NR_OBJS);
+                else
+                    lookup(kind, (n++ * 7 + i) % NR_OBJS);
+                // no references are held here
+                rcu_quiescent_state();
+            }
+            reads[i] = n;
+            SYNC(++round)
+            if (i == 0) {
+                u64 total = 0;
+                for (int j = 0; j < NCPU; j++)
+                    total += reads[j];
+                result[kind][ncpu - 1] = total * 1000 / BENCH_MS;
+            }
+            SYNC(++round)
+        }
+    }
+    exit(0);
+}
+
+// one worker per cpu looks objects up in a list that worker 0 changes now
+// and then, under an RWLock and under RCU, and looks processes up by pid.
+// Lookups per second should grow with the number of cpus. Run it from a
+// kernel process.
+void rcu_bench() {
+    int code;
+    init_list_node(&objs);
+    init_rwlock(&objs_rwlock);
+    init_spinlock(&objs_lock);
+    init_rc(&x);
+    for (int i = 0; i < NR_OBJS; i++)
+        _insert_into_list(&objs, &new_obj(i)->node);
+    for (int i = 0; i < NCPU; i++) {
+        struct proc* p = create_proc();
+        set_parent_to_this(p);
+        worker_pid[i] = p->pid;
+        start_proc_pinned(p, i, bench_worker, i);
+    }
+    for (int i = 0; i < NCPU; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a worker\n");
+    for (int kind = 0; kind < NR_KINDS; kind++)
+        printk("%s: lookups/s on 1 cpu %llu, 2 cpus %llu, 3 cpus %llu, "
+               "4 cpus %llu\n", kind_name[kind], result[kind][0],
+               result[kind][1], result[kind][2], result[kind][3]);
+    // the workers are gone, nobody reads the list any more
+    while (!_empty_list(&objs)) {
+        struct obj* o = container_of(objs.next, struct obj, node);
+        _detach_from_list(&o->node);
+        kill_obj(o);
+    }
+    printk("rcu_bench PASS\n");
+}
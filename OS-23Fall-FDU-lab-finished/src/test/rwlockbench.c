@@ -0,0 +1,144 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/rwlock.h>
+#include <common/seqlock.h>
+#include <common/spinlock.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+#define SYNC(i)                                                                \
+    arch_dsb_sy();                                                             \
+    _increment_rc(&x);                                                         \
+    while (x.count < 4 * i)                                                    \
+        ;                                                                      \
+    arch_dsb_sy();
+
+#define BENCH_MS 200
+#define NR_ENTRIES 16
+#define WRITE_EVERY 1024    // cpu 0 writes once per this many operations
+
+enum { USE_SPINLOCK, USE_RWLOCK, USE_SEQLOCK, NR_KINDS };
+static const char* kind_name[NR_KINDS] = {"spinlock", "rwlock", "seqlock"};
+
+static RefCount x;
+static SpinLock slock;
+static RWLock rwlock;
+static SeqLock seqlock;
+// a writer leaves every entry equal, a reader checks that it sees them so
+static u64 table[NR_ENTRIES];
+static u64 reads[4];
+
+static bool table_consistent() {
+    for (int i = 1; i < NR_ENTRIES; i++)
+        if (table[i] != table[0])
+            return false;
+    return true;
+}
+
+static void table_write() {
+    for (int i = 0; i < NR_ENTRIES; i++)
+        table[i]++;
+}
+
+static bool table_read(int kind) {
+    bool ok;
+    u32 seq;
+    switch (kind) {
+    case USE_SPINLOCK:
+        _acquire_spinlock(&slock);
+        ok = table_consistent();
+        _release_spinlock(&slock);
+        return ok;
+    case USE_RWLOCK:
+        _acquire_read_lock(&rwlock);
+        ok = table_consistent();
+        _release_read_lock(&rwlock);
+        return ok;
+    default:
+        do {
+            seq = read_seqbegin(&seqlock);
+            ok = table_consistent();
+        } while (read_seqretry(&seqlock, seq));
+        return ok;
+    }
+}
+
+static void table_update(int kind) {
+    switch (kind) {
+    case USE_SPINLOCK:
+        _acquire_spinlock(&slock);
+        table_write();
+        _release_spinlock(&slock);
+        break;
+    case USE_RWLOCK:
+        _acquire_write_lock(&rwlock);
+        table_write();
+        _release_write_lock(&rwlock);
+        break;
+    default:
+        write_seqlock(&seqlock);
+        table_write();
+        write_sequnlock(&seqlock);
+        break;
+    }
+}
+
+// reads by this cpu in BENCH_MS, if it is one of the first `ncpu`.
+static u64 read_loop(int kind, int ncpu) {
+    int i = cpuid();
+    if (i >= ncpu)
+        return 0;
+    u64 end = get_timestamp() + get_clock_frequency() / 1000 * BENCH_MS;
+    u64 n = 0, ops = 0;
+    while (get_timestamp() < end) {
+        if (i == 0 && ++ops % WRITE_EVERY == 0) {
+            table_update(kind);
+            continue;
+        }
+        if (!table_read(kind))
+            FAIL("FAIL: %s reader saw a torn table\n", kind_name[kind]);
+        n++;
+    }
+    return n;
+}
+
+// all CPUs read a small table that cpu 0 updates now and then, under an
+// exclusive spinlock, a reader-writer lock and a seqlock. Reader
+// throughput should grow with the number of CPUs for the last two.
+void rwlock_bench() {
+    int i = cpuid();
+    int round = 0;
+    if (i == 0) {
+        init_spinlock(&slock);
+        init_rwlock(&rwlock);
+        init_seqlock(&seqlock);
+    }
+    SYNC(++round)
+    for (int kind = 0; kind < NR_KINDS; kind++) {
+        u64 per_ncpu[4];
+        for (int ncpu = 1; ncpu <= 4; ncpu++) {
+            reads[i] = read_loop(kind, ncpu);
+            SYNC(++round)
+            u64 total = 0;
+            for (int j = 0; j < 4; j++)
+                total += reads[j];
+            per_ncpu[ncpu - 1] = total * 1000 / BENCH_MS;
+            SYNC(++round)
+        }
+        if (i == 0)
+            printk("%s: reads/s on 1 cpu %llu, 2 cpus %llu, 3 cpus %llu, "
+                   "4 cpus %llu\n", kind_name[kind], per_ncpu[0], per_ncpu[1],
+                   per_ncpu[2], per_ncpu[3]);
+    }
+    if (i == 0) {
+        if (!table_consistent())
+            FAIL("FAIL: table is torn at the end\n");
+        printk("rwlock_bench PASS\n");
+    }
+}
@@ -0,0 +1,299 @@
+#include <aarch64/intrinsic.h>
+#include <common/sem.h>
+#include <driver/clock.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+
+#define BENCH_MS 200
+
+void set_parent_to_this(struct proc* proc);
+
+#define MAX_YIELDERS 256
+
+static volatile bool stop;
+static u64 loops[MAX_YIELDERS];
+
+static void yielder(u64 arg) {
+    loops[arg] = 0;
+    while (!stop) {
+        loops[arg]++;
+        yield();
+    }
+    exit(0);
+}
+
+// n pairs of processes that only yield, pair k pinned to cpu k % NCPU, so
+// min(n, NCPU) cpus switch back and forth. run it from a kernel process.
+static void sched_bench_n(int n) {
+    u64 before[NCPU], total = 0;
+    int busy = 0;
+    stop = false;
+    for (int i = 0; i < NCPU; i++)
+        before[i] = cpus[i].sched.nr_switch;
+    for (int i = 0; i < 2 * n; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc_pinned(p, i / 2 % NCPU, yielder, i);
+    }
+    sleep_ms(BENCH_MS);
+    for (int i = 0; i < NCPU; i++) {
+        u64 d = cpus[i].sched.nr_switch - before[i];
+        total += d;
+        if (d > 0)
+            busy++;
+    }
+    stop = true;
+    int code;
+    for (int i = 0; i < 2 * n; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a yielder\n");
+    u64 min = loops[0], max = loops[0];
+    for (int i = 1; i < 2 * n; i++) {
+        min = MIN(min, loops[i]);
+        max = MAX(max, loops[i]);
+    }
+    printk("%d yielder pairs: %llu switches/s on %d cpus, loops min %llu max %llu\n",
+           n, total * 1000 / BENCH_MS, busy, min, max);
+}
+
+#define NICE_LOW 5
+
+static void spinner(u64 arg) {
+    if (arg % 2)
+        set_nice(thisproc(), NICE_LOW);
+    loops[arg] = 0;
+    while (!stop) {
+        // kernel code runs with interrupts off, let the tick preempt us
+        arch_with_trap {
+            for (volatile int i = 0; i < 1000; i++)
+                ;
+        }
+        loops[arg]++;
+    }
+    exit(0);
+}
+
+// half of the spinners run at nice 0 and half at NICE_LOW, all on the last
+// cpu. the loops done by each group should be in the ratio of their weights
+// (1024 : 335).
+void sched_nice_test() {
+    int n = 2 * NCPU, code;
+    u64 share[2] = {0, 0};
+    stop = false;
+    for (int i = 0; i < n; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc_pinned(p, NCPU - 1, spinner, i);
+    }
+    // keep the driver off the measured cpu
+    u32 old = get_affinity(thisproc());
+    ASSERT(set_affinity(thisproc(), CPU_MASK_ALL >> 1) == 0);
+    sleep_ms(BENCH_MS * 5);
+    stop = true;
+    ASSERT(set_affinity(thisproc(), old) == 0);
+    for (int i = 0; i < n; i++) {
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a spinner\n");
+        share[i % 2] += loops[i];
+    }
+    if (share[1] == 0 || share[0] < 2 * share[1] || 2 * share[0] > 9 * share[1])
+        FAIL("FAIL: nice 0 got %llu loops, nice %d got %llu\n", share[0],
+             NICE_LOW, share[1]);
+    printk("nice 0 : nice %d cpu share = %llu%%, weights %llu%%\n", NICE_LOW,
+           share[0] * 100 / share[1], 1024ull * 100 / 335);
+    printk("sched_nice_test PASS\n");
+}
+
+#define WAKEUP_ROUNDS 1000
+
+static Semaphore wake, woken;
+static volatile u64 posted_at;
+static u64 latency_sum, latency_max;
+
+static void sleeper(u64 arg) {
+    for (u64 i = 0; i < arg; i++) {
+        unalertable_wait_sem(&wake);
+        u64 d = get_timestamp() - posted_at;
+        latency_sum += d;
+        latency_max = MAX(latency_max, d);
+        post_sem(&woken);
+    }
+    exit(0);
+}
+
+// time from post_sem() to the woken process running. the poster waits a
+// little before each post so that the sleeper's cpu is back in wfi.
+void sched_wakeup_bench() {
+    int code;
+    init_sem(&wake, 0);
+    init_sem(&woken, 0);
+    latency_sum = latency_max = 0;
+    auto p = create_proc();
+    set_parent_to_this(p);
+    start_proc(p, sleeper, WAKEUP_ROUNDS);
+    for (int i = 0; i < WAKEUP_ROUNDS; i++) {
+        delay_us(100);
+        posted_at = get_timestamp();
+        post_sem(&wake);
+        unalertable_wait_sem(&woken);
+    }
+    if (wait(&code) == -1)
+        FAIL("FAIL: lost the sleeper\n");
+    u64 one_us = get_clock_frequency() / 1000000;
+    printk("wakeup latency: avg %llu us, max %llu us\n",
+           latency_sum / WAKEUP_ROUNDS / one_us, latency_max / one_us);
+    printk("sched_wakeup_bench PASS\n");
+}
+
+#define RT_ROUNDS 200
+#define RT_PRIO 50
+
+// worst wakeup latency in us of a sleeper with `policy` that shares the
+// last cpu with NCPU busy normal processes.
+static u64 rt_jitter(int policy) {
+    int code;
+    stop = false;
+    init_sem(&wake, 0);
+    init_sem(&woken, 0);
+    latency_sum = latency_max = 0;
+    for (int i = 0; i < NCPU; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc_pinned(p, NCPU - 1, spinner, 2 * i);
+    }
+    auto p = create_proc();
+    set_parent_to_this(p);
+    ASSERT(set_scheduler(p, policy, policy == SCHED_NORMAL ? 0 : RT_PRIO) == 0);
+    start_proc_pinned(p, NCPU - 1, sleeper, RT_ROUNDS);
+    for (int i = 0; i < RT_ROUNDS; i++) {
+        delay_us(500);
+        posted_at = get_timestamp();
+        post_sem(&wake);
+        unalertable_wait_sem(&woken);
+    }
+    stop = true;
+    for (int i = 0; i < NCPU + 1; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a child\n");
+    return latency_max / (get_clock_frequency() / 1000000);
+}
+
+// worst wakeup latency in us of a SCHED_FIFO sleeper that may run anywhere.
+// it last ran on the last cpu, which is then taken by a SCHED_FIFO spinner
+// of the same priority, and normal processes keep every cpu busy. each
+// wakeup has to go to a cpu that runs normal work.
+static u64 rt_spread_jitter() {
+    int code, n = 2 * NCPU;
+    stop = false;
+    init_sem(&wake, 0);
+    init_sem(&woken, 0);
+    for (int i = 0; i < n; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc(p, spinner, 2 * i);
+    }
+    auto p = create_proc();
+    set_parent_to_this(p);
+    ASSERT(set_scheduler(p, SCHED_FIFO, RT_PRIO) == 0);
+    start_proc_pinned(p, NCPU - 1, sleeper, RT_ROUNDS + 1);
+    post_sem(&wake);
+    unalertable_wait_sem(&woken);
+    ASSERT(set_affinity(p, CPU_MASK_ALL) == 0);
+    auto hog = create_proc();
+    set_parent_to_this(hog);
+    ASSERT(set_scheduler(hog, SCHED_FIFO, RT_PRIO) == 0);
+    start_proc_pinned(hog, NCPU - 1, spinner, 2 * n);
+    latency_sum = latency_max = 0;
+    for (int i = 0; i < RT_ROUNDS; i++) {
+        delay_us(500);
+        posted_at = get_timestamp();
+        post_sem(&wake);
+        unalertable_wait_sem(&woken);
+    }
+    stop = true;
+    for (int i = 0; i < n + 2; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a child\n");
+    return latency_max / (get_clock_frequency() / 1000000);
+}
+
+// a SCHED_FIFO sleeper should preempt the background load as soon as it is
+// woken, a SCHED_NORMAL one waits for the end of a slice.
+void sched_rt_test() {
+    u32 old = get_affinity(thisproc());
+    ASSERT(set_affinity(thisproc(), CPU_MASK_ALL >> 1) == 0);
+    u64 normal = rt_jitter(SCHED_NORMAL);
+    u64 fifo = rt_jitter(SCHED_FIFO);
+    u64 spread = rt_spread_jitter();
+    ASSERT(set_affinity(thisproc(), old) == 0);
+    printk("wakeup jitter under load: SCHED_NORMAL max %llu us, SCHED_FIFO "
+           "max %llu us, SCHED_FIFO on a busy cpu max %llu us\n", normal,
+           fifo, spread);
+    if (fifo > 1000)
+        FAIL("FAIL: SCHED_FIFO woke up %llu us late\n", fifo);
+    if (spread > 1000)
+        FAIL("FAIL: SCHED_FIFO woke up %llu us late next to an equal "
+             "priority\n", spread);
+    printk("sched_rt_test PASS\n");
+}
+
+#define NR_NAPPERS 16
+#define NAP_SLACK_US 2000
+
+static u64 overslept[NR_NAPPERS];
+static volatile bool woke_early;
+
+static void napper(u64 arg) {
+    u64 ms = 10 * (arg + 1);
+    u64 start = get_timestamp();
+    u64 left = sleep_ms(ms);
+    u64 us = (get_timestamp() - start) * 1000000 / get_clock_frequency();
+    // the timers count whole ms, so up to 1 ms short is fine
+    if (left != 0 || us + 1000 < ms * 1000)
+        woke_early = true;
+    overslept[arg] = us > ms * 1000 ? us - ms * 1000 : 0;
+    exit(0);
+}
+
+// processes sleeping for 10, 20, .. ms must wake on time, and not before.
+void sched_sleep_test() {
+    int code;
+    u64 max = 0;
+    woke_early = false;
+    for (int i = 0; i < NR_NAPPERS; i++) {
+        auto p = create_proc();
+        set_parent_to_this(p);
+        start_proc(p, napper, i);
+    }
+    for (int i = 0; i < NR_NAPPERS; i++)
+        if (wait(&code) == -1)
+            FAIL("FAIL: lost a napper\n");
+    if (woke_early)
+        FAIL("FAIL: sleep_ms returned early\n");
+    for (int i = 0; i < NR_NAPPERS; i++)
+        max = MAX(max, overslept[i]);
+    if (max > NAP_SLACK_US)
+        FAIL("FAIL: overslept by %llu us\n", max);
+    printk("sleep_ms: woke at most %llu us late\n", max);
+    printk("sched_sleep_test PASS\n");
+}
+
+void sched_bench() {
+    sched_bench_n(1);
+    sched_bench_n(2);
+    sched_bench_n(4);
+    // the switch cost should not grow with the length of the run queue,
+    // and every yielder should get about the same number of loops.
+    sched_bench_n(MAX_YIELDERS / 2);
+    printk("sched_bench PASS\n");
+}
@@ -0,0 +1,79 @@
+#include <aarch64/intrinsic.h>
+#include <common/string.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+
+#define ROUNDS 256
+
+static u8 a[8192] __attribute__((aligned(64)));
+static u8 b[8192] __attribute__((aligned(64)));
+static u8 c[8192] __attribute__((aligned(64)));
+static u8 d[8192] __attribute__((aligned(64)));
+
+// compare against the byte loops on random sizes and alignments first.
+static void string_check() {
+    for (int i = 0; i < 4096; i++) {
+        for (int j = 0; j < 8192; j++)
+            a[j] = c[j] = (u8)rand();
+        int n = rand() % 4500, x = rand() % 128, y = rand() % 128;
+        int v = rand() & 1 ? 0 : rand();
+        switch (i % 3) {
+            case 0:
+                memset(a + x, v, n);
+                memset_bytes(c + x, v, n);
+                break;
+            case 1:
+                memcpy(b + x, a + y, n);
+                memcpy_bytes(d + x, c + y, n);
+                if (memcmp(b, d, x + n))
+                    FAIL("FAIL: memcpy(+%d, +%d, %d)\n", x, y, n);
+                break;
+            case 2:
+                memmove(a + x, a + y, n);
+                memmove_bytes(c + x, c + y, n);
+                break;
+        }
+        if (memcmp(a, c, sizeof(a)))
+            FAIL("FAIL: case %d (+%d, +%d, %d)\n", i % 3, x, y, n);
+    }
+}
+
+#define BENCH(name, call)                                                      \
+    {                                                                          \
+        u64 t = get_cycles();                                                  \
+        for (int r = 0; r < ROUNDS; r++)                                       \
+            call;                                                              \
+        t = get_cycles() - t;                                                  \
+        printk("  %s: %lld cycles\n", name, t / ROUNDS);                       \
+    }
+
+void string_bench() {
+    if (cpuid() != 0)
+        return;
+    printk("string_bench\n");
+    arch_enable_cycle_counter();
+    string_check();
+    static const int sizes[] = {64, 512, 4096};
+    for (int i = 0; i < 3; i++) {
+        int n = sizes[i];
+        printk("%d bytes, aligned\n", n);
+        BENCH("memset_bytes ", memset_bytes(a, 0, n));
+        BENCH("memset       ", memset(a, 0, n));
+        BENCH("memset (0x5a)", memset(a, 0x5a, n));
+        BENCH("memcpy_bytes ", memcpy_bytes(a, b, n));
+        BENCH("memcpy       ", memcpy(a, b, n));
+        BENCH("memmove_bytes", memmove_bytes(a + 64, a, n));
+        BENCH("memmove      ", memmove(a + 64, a, n));
+        printk("%d bytes, src +3 dst +5\n", n);
+        BENCH("memcpy_bytes ", memcpy_bytes(a + 5, b + 3, n));
+        BENCH("memcpy       ", memcpy(a + 5, b + 3, n));
+    }
+    printk("string_bench PASS\n");
+}
@@ -4,9 +4,22 @@
 
 void alloc_test();
 void rbtree_test();
+void timer_wheel_test();
 void proc_test();
 void ipc_test();
+void pipe_wakeup_bench();
 void vm_test();
 void user_proc_test();
+void string_bench();
+void lock_bench();
+void rwlock_bench();
+void rcu_bench();
+void sem_pingpong_bench();
+void futex_test();
+void sched_bench();
+void sched_nice_test();
+void sched_wakeup_bench();
+void sched_rt_test();
+void sched_sleep_test();
 unsigned rand();
 void srand(unsigned seed);
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include <common/rbtree.h>
+#include <driver/clock.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define FAIL(...)                                                              \
+    {                                                                          \
+        printk(__VA_ARGS__);                                                   \
+        while (1)                                                              \
+            ;                                                                  \
+    }
+
+#define NR_TIMERS 4096
+
+static struct timer timers[NR_TIMERS];
+static struct timer_wheel wheel;
+
+// the timer queue the wheel replaced, kept here to compare against
+static struct rb_timer {
+    struct rb_node_ node;
+    u64 key;
+} rb_timers[NR_TIMERS];
+static struct rb_root_ rb_queue;
+
+static bool rb_timer_cmp(rb_node lnode, rb_node rnode)
+{
+    i64 d = container_of(lnode, struct rb_timer, node)->key -
+            container_of(rnode, struct rb_timer, node)->key;
+    if (d < 0)
+        return true;
+    if (d == 0)
+        return lnode < rnode;
+    return false;
+}
+
+static u64 delays[NR_TIMERS];
+
+// about a quarter of the timers are minutes away, the rest within 5 s.
+static u64 random_delay()
+{
+    if (rand() % 4)
+        return rand() % 5000;
+    return ((u64)rand() * RAND_MAX + rand()) % (1 << 20);
+}
+
+// drive a wheel with a fake clock: every timer that is not cancelled must
+// come out exactly at its expiry, jumping from one timer_wheel_next() to
+// the next.
+static void timer_wheel_check()
+{
+    u64 now = 1000;
+    int left = 0;
+    init_timer_wheel(&wheel, now);
+    for (int i = 0; i < NR_TIMERS; i++) {
+        timers[i]._key = now + random_delay();
+        timers[i].triggered = false;
+        timer_wheel_add(&wheel, &timers[i], now);
+    }
+    for (int i = 0; i < NR_TIMERS; i += 3)
+        timer_wheel_del(&wheel, &timers[i]);
+    for (int i = 0; i < NR_TIMERS; i++)
+        left += i % 3 != 0;
+    while (left > 0) {
+        u64 next = timer_wheel_next(&wheel);
+        if (next == WHEEL_NONE)
+            FAIL("FAIL: %d timers lost\n", left);
+        now = MAX(now, next);
+        struct timer* t;
+        while ((t = timer_wheel_expire(&wheel, now)) != NULL) {
+            int i = t - timers;
+            if (i % 3 == 0 || t->triggered)
+                FAIL("FAIL: timer %d fired after cancel\n", i);
+            if (t->_key != now)
+                FAIL("FAIL: timer %d for %llu fired at %llu\n", i, t->_key, now);
+            t->triggered = true;
+            left--;
+        }
+    }
+    if (timer_wheel_next(&wheel) != WHEEL_NONE)
+        FAIL("FAIL: wheel not empty\n");
+    // an hour without interrupts: the empty wheel catches up on add
+    now += 3600 * 1000;
+    timers[0]._key = now + 5;
+    timer_wheel_add(&wheel, &timers[0], now);
+    if (wheel.clk != now)
+        FAIL("FAIL: empty wheel left at %llu, now %llu\n", wheel.clk, now);
+    if (timer_wheel_expire(&wheel, now + 5) != &timers[0])
+        FAIL("FAIL: timer lost after an idle hour\n");
+}
+
+// cost of queueing and then cancelling NR_TIMERS timers, as a context
+// switch does with the time slice timer.
+static void timer_wheel_bench()
+{
+    u64 now = get_timestamp_ms();
+    for (int i = 0; i < NR_TIMERS; i++)
+        delays[i] = random_delay();
+    init_timer_wheel(&wheel, now);
+    u64 t0 = get_timestamp();
+    for (int i = 0; i < NR_TIMERS; i++) {
+        timers[i]._key = now + delays[i];
+        timer_wheel_add(&wheel, &timers[i], now);
+    }
+    u64 t1 = get_timestamp();
+    for (int i = 0; i < NR_TIMERS; i++)
+        timer_wheel_del(&wheel, &timers[i]);
+    u64 t2 = get_timestamp();
+    rb_queue.rb_node = NULL;
+    for (int i = 0; i < NR_TIMERS; i++) {
+        rb_timers[i].key = now + delays[i];
+        ASSERT(0 == _rb_insert(&rb_timers[i].node, &rb_queue, rb_timer_cmp));
+    }
+    u64 t3 = get_timestamp();
+    for (int i = 0; i < NR_TIMERS; i++)
+        _rb_erase(&rb_timers[i].node, &rb_queue);
+    u64 t4 = get_timestamp();
+    u64 hz = get_clock_frequency();
+    printk("%d timers, ns per op: wheel add %llu del %llu, rbtree insert %llu "
+           "erase %llu\n", NR_TIMERS,
+           (t1 - t0) * 1000000000 / hz / NR_TIMERS,
+           (t2 - t1) * 1000000000 / hz / NR_TIMERS,
+           (t3 - t2) * 1000000000 / hz / NR_TIMERS,
+           (t4 - t3) * 1000000000 / hz / NR_TIMERS);
+}
+
+void timer_wheel_test()
+{
+    srand(42);
+    timer_wheel_check();
+    timer_wheel_bench();
+    printk("timer_wheel_test PASS\n");
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# Per-process run, wait and sleep time histograms from the output of the
+# schedtrace syscall (see src/kernel/schedtrace.h).
+#
+#   python3 tools/schedtrace.py console.log
+#
+# The input may contain other console output, only `schedtrace:` lines
+# between `begin` and `end` are used. Times are printed in microseconds.
+
+import sys
+from argparse import ArgumentParser
+from collections import defaultdict
+
+# enum procstate in src/kernel/proc.h
+RUNNABLE, SLEEPING, DEEPSLEEPING = 1, 3, 4
+
+def parse(lines):
+    freq, events = None, []
+    for line in lines:
+        pos = line.find('schedtrace: ')
+        if pos < 0:
+            continue
+        words = line[pos:].split()[1:]
+        if words[0] == 'begin':
+            freq, events = int(words[2]), []
+        elif words[0] != 'end' and len(words) == 6:
+            cpu, ts, kind, pid, arg, arg2 = words
+            events.append((int(ts), int(cpu), kind, int(pid), int(arg), int(arg2)))
+    if freq is None:
+        sys.exit('no schedtrace dump found')
+    events.sort()
+    return freq, events
+
+def measure(events):
+    run, wait, sleep = (defaultdict(list) for _ in range(3))
+    running = {}        # pid -> when it was switched in
+    runnable = {}       # pid -> when it became runnable
+    sleeping = {}       # pid -> when it went to sleep
+    for ts, cpu, kind, pid, arg, arg2 in events:
+        if kind == 'switch':
+            prev, state, nxt = pid, arg, arg2
+            if prev >= 0:
+                if prev in running:
+                    run[prev].append(ts - running.pop(prev))
+                if state == RUNNABLE:
+                    runnable[prev] = ts
+                elif state in (SLEEPING, DEEPSLEEPING):
+                    sleeping[prev] = ts
+            if nxt >= 0:
+                if nxt in runnable:
+                    wait[nxt].append(ts - runnable.pop(nxt))
+                running[nxt] = ts
+        elif kind == 'wakeup':
+            wakee = arg
+            if wakee in sleeping:
+                sleep[wakee].append(ts - sleeping.pop(wakee))
+            runnable[wakee] = ts
+    return run, wait, sleep
+
+def histogram(title, samples, freq):
+    us = [s * 1000000 // freq for s in samples]
+    buckets = defaultdict(int)
+    for v in us:
+        buckets[max(v, 1).bit_length() - 1] += 1
+    print(f'  {title}: n={len(us)} total={sum(us)}us max={max(us)}us')
+    width = max(buckets.values())
+    for b in sorted(buckets):
+        lo, hi = (0 if b == 0 else 1 << b), (2 << b) - 1
+        bar = '#' * max(1, buckets[b] * 40 // width)
+        print(f'    {lo:>9}-{hi:<9} {buckets[b]:>7} {bar}')
+
+def main():
+    parser = ArgumentParser(description='run, wait and sleep histograms from a schedtrace dump')
+    parser.add_argument('log', nargs='?', help='console output, default stdin')
+    parser.add_argument('-p', '--pid', type=int, action='append',
+                        help='only show these pids')
+    args = parser.parse_args()
+    lines = open(args.log, errors='replace') if args.log else sys.stdin
+    freq, events = parse(lines)
+    run, wait, sleep = measure(events)
+    span = (events[-1][0] - events[0][0]) * 1000000 // freq if events else 0
+    print(f'{len(events)} events over {span}us')
+    for pid in sorted(set(run) | set(wait) | set(sleep)):
+        if args.pid and pid not in args.pid:
+            continue
+        print(f'pid {pid}')
+        for title, table in (('run', run), ('wait', wait), ('sleep', sleep)):
+            if table[pid]:
+                histogram(title, table[pid], freq)
+
+if __name__ == '__main__':
+    main()